@@ -0,0 +1,303 @@
+/* date = October 19th 2026 */
+
+/*
+Microbenchmarks for the ticket.c primitives. No window is created, so it runs headless.
+ticket.c is included directly to reach its internal functions.
+
+Build: cc -O2 bench.c -o bench $(sdl2-config --cflags --libs) -lm
+Usage: ./bench [repetitions]
+
+Output is CSV on stdout, one line per benchmark and size:
+name,size,repetitions,ns_per_op_median,ns_per_op_min,ops_per_sec
+*/
+
+#include "ticket.c"
+
+#define DEFAULT_REPETITIONS 7
+#define WARMUP_REPETITIONS 2
+#define MAX_REPETITIONS 101
+#define RECT_AREA_SIZE 60
+
+typedef struct bench_item{
+    float x, y;
+    float dx, dy;
+    int w, h;
+}bench_item_t;
+
+TK_DARRAY(bench_item_t)
+
+/* Returns the performance counter ticks spent on n operations */
+typedef Uint64 (*bench_fn)(size_t n);
+
+typedef struct bench{
+    const char *name;
+    bench_fn fn;
+    size_t sizes[3];
+}bench_t;
+
+/* Written by every benchmark, so that the compiler can not drop the measured work */
+static volatile int sink;
+
+static Uint64 _bench_darray_push(size_t n)
+{
+    bench_item_t item = {1.0f, 2.0f, 3.0f, 4.0f, 5, 6};
+    bench_item_t *darray;
+    Uint64 start, end;
+    size_t i;
+    
+    start = SDL_GetPerformanceCounter();
+    darray = tk_darray_create(sizeof(bench_item_t));
+    for (i = 0; i < n; i++){
+        item.w = (int)i;
+        tk_darray_push((void**)&darray, &item);
+    }
+    sink = darray[n - 1].w;
+    tk_darray_destroy(darray);
+    end = SDL_GetPerformanceCounter();
+    
+    return end - start;
+}
+
+static Uint64 _bench_darray_push_typed(size_t n)
+{
+    bench_item_t item = {1.0f, 2.0f, 3.0f, 4.0f, 5, 6};
+    bench_item_t *darray;
+    Uint64 start, end;
+    size_t i;
+    
+    start = SDL_GetPerformanceCounter();
+    darray = bench_item_t_darray_create();
+    for (i = 0; i < n; i++){
+        item.w = (int)i;
+        bench_item_t_darray_push(&darray, item);
+    }
+    sink = darray[n - 1].w;
+    bench_item_t_darray_destroy(darray);
+    end = SDL_GetPerformanceCounter();
+    
+    return end - start;
+}
+
+static Uint64 _bench_list_push_back(size_t n)
+{
+    static int data;
+    tk_node_t *list;
+    Uint64 start, end;
+    size_t i;
+    
+    start = SDL_GetPerformanceCounter();
+    list = tk_list_create(&data);
+    for (i = 0; i < n; i++){
+        tk_list_push_back(list, &data);
+    }
+    sink = (tk_list_get_back(list)->data == &data);
+    tk_list_destroy(&list, 0);
+    end = SDL_GetPerformanceCounter();
+    
+    return end - start;
+}
+
+static Uint64 _bench_hashmap_insert(size_t n)
+{
+    tk_hashmap_t *map;
+    Uint64 start, end;
+    Uint32 key;
+    size_t i;
+    
+    start = SDL_GetPerformanceCounter();
+    map = tk_hashmap_create(sizeof(Uint32), sizeof(size_t));
+    for (i = 0; i < n; i++){
+        key = (Uint32)i * 2654435761u; /* Spread out, like entity handles or asset ids */
+        tk_hashmap_insert(map, &key, &i);
+    }
+    sink = (int)tk_hashmap_count(map);
+    tk_hashmap_destroy(map);
+    end = SDL_GetPerformanceCounter();
+    
+    return end - start;
+}
+
+static Uint64 _bench_hashmap_find(size_t n)
+{
+    tk_hashmap_t *map;
+    size_t *item;
+    size_t i, sum = 0;
+    Uint64 start, end;
+    Uint32 key;
+    
+    map = tk_hashmap_create(sizeof(Uint32), sizeof(size_t));
+    for (i = 0; i < n; i++){
+        key = (Uint32)i * 2654435761u;
+        tk_hashmap_insert(map, &key, &i);
+    }
+    
+    /* Every other lookup misses */
+    start = SDL_GetPerformanceCounter();
+    for (i = 0; i < n; i++){
+        key = (Uint32)(i >> 1) * ((i & 1) ? 2654435769u : 2654435761u);
+        item = tk_hashmap_find(map, &key);
+        if (item) sum += *item;
+    }
+    end = SDL_GetPerformanceCounter();
+    
+    sink = (int)sum;
+    tk_hashmap_destroy(map);
+    
+    return end - start;
+}
+
+static Uint64 _bench_list_find(size_t n)
+{
+    static int data[4096];
+    tk_node_t *list;
+    size_t i, found = 0;
+    Uint64 start, end;
+    
+    list = tk_list_create(&data[0]);
+    for (i = 1; i < n; i++){
+        tk_list_push_back(list, &data[i]);
+    }
+    
+    start = SDL_GetPerformanceCounter();
+    for (i = 0; i < n; i++){
+        found += (tk_list_find(list, &data[(i * 7) % n]) != NULL);
+    }
+    end = SDL_GetPerformanceCounter();
+    
+    sink = (int)found;
+    tk_list_destroy(&list, 0);
+    
+    return end - start;
+}
+
+static Uint64 _bench_rect_vs_rect(size_t n)
+{
+    int *rects;
+    int hits = 0;
+    Uint64 start, end;
+    size_t i, next;
+    
+    /* x, y, w, h for every rect, packed in a 60x60 area so that about half of the pairs overlap.
+       Mostly hits or mostly misses would only measure a well predicted branch */
+    rects = malloc(sizeof(int) * 4 * n);
+    if (!rects) exit(1);
+    for (i = 0; i < n; i++){
+        rects[i * 4 + 0] = tkmt_rand(0, RECT_AREA_SIZE);
+        rects[i * 4 + 1] = tkmt_rand(0, RECT_AREA_SIZE);
+        rects[i * 4 + 2] = tkmt_rand(5, 60);
+        rects[i * 4 + 3] = tkmt_rand(5, 60);
+    }
+    
+    start = SDL_GetPerformanceCounter();
+    for (i = 0; i < n; i++){
+        next = (i + 1 == n) ? 0 : i + 1;
+        hits += tkcol_rect_vs_rect(rects[i * 4 + 0], rects[i * 4 + 1], rects[i * 4 + 2], rects[i * 4 + 3],
+                                   rects[next * 4 + 0], rects[next * 4 + 1], rects[next * 4 + 2], rects[next * 4 + 3]);
+    }
+    end = SDL_GetPerformanceCounter();
+    
+    sink = hits;
+    free(rects);
+    
+    return end - start;
+}
+
+static Uint64 _bench_randf(size_t n)
+{
+    float sum = 0.0f;
+    Uint64 start, end;
+    size_t i;
+    
+    start = SDL_GetPerformanceCounter();
+    for (i = 0; i < n; i++){
+        sum += tkmt_randf(-150.0f, 150.0f);
+    }
+    end = SDL_GetPerformanceCounter();
+    
+    sink = (int)sum;
+    
+    return end - start;
+}
+
+static Uint64 _bench_hex_to_rgba(size_t n)
+{
+    static char *colors[] = { WHITE, BLACK, PEARL, LIGHTGRAY, GRAY, PALEBLUE, SKYBLUE, LIGHTBLUE };
+    int rgba[3];
+    int sum = 0;
+    Uint64 start, end;
+    size_t i;
+    
+    start = SDL_GetPerformanceCounter();
+    for (i = 0; i < n; i++){
+        _hex_to_rgba(colors[i & 7], rgba);
+        sum += rgba[0] + rgba[1] + rgba[2];
+    }
+    end = SDL_GetPerformanceCounter();
+    
+    sink = sum;
+    
+    return end - start;
+}
+
+static int _compare_double(const void *a, const void *b)
+{
+    double lhs = *(const double*)a;
+    double rhs = *(const double*)b;
+    
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static void _run_bench(const bench_t *bench, size_t n, int repetitions)
+{
+    double ns_per_op[MAX_REPETITIONS];
+    double ns_per_tick = 1e9 / (double)SDL_GetPerformanceFrequency();
+    double median;
+    int i;
+    
+    for (i = 0; i < WARMUP_REPETITIONS; i++){
+        bench->fn(n);
+    }
+    
+    for (i = 0; i < repetitions; i++){
+        ns_per_op[i] = (double)bench->fn(n) * ns_per_tick / (double)n;
+    }
+    
+    qsort(ns_per_op, repetitions, sizeof(double), _compare_double);
+    median = ns_per_op[repetitions / 2];
+    
+    printf("%s,%zu,%d,%.3f,%.3f,%.0f\n", bench->name, n, repetitions,
+           median, ns_per_op[0], (median > 0.0) ? 1e9 / median : 0.0);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    static const bench_t benches[] = {
+        { "darray_push", _bench_darray_push, { 16, 1024, 65536 } },
+        { "darray_push_typed", _bench_darray_push_typed, { 16, 1024, 65536 } },
+        { "list_push_back", _bench_list_push_back, { 16, 256, 4096 } },
+        { "list_find", _bench_list_find, { 16, 256, 4096 } },
+        { "hashmap_insert", _bench_hashmap_insert, { 16, 1024, 65536 } },
+        { "hashmap_find", _bench_hashmap_find, { 16, 4096, 65536 } },
+        { "rect_vs_rect", _bench_rect_vs_rect, { 64, 4096, 262144 } },
+        { "randf", _bench_randf, { 64, 4096, 262144 } },
+        { "hex_to_rgba", _bench_hex_to_rgba, { 64, 4096, 262144 } },
+    };
+    int repetitions = DEFAULT_REPETITIONS;
+    size_t i, j;
+    
+    if (argc > 1){
+        repetitions = tkmt_clamp(atoi(argv[1]), 1, MAX_REPETITIONS);
+    }
+    
+    srand(1); /* Same random data on every run */
+    
+    printf("name,size,repetitions,ns_per_op_median,ns_per_op_min,ops_per_sec\n");
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++){
+        for (j = 0; j < sizeof(benches[i].sizes) / sizeof(benches[i].sizes[0]); j++){
+            _run_bench(&benches[i], benches[i].sizes[j], repetitions);
+        }
+    }
+    
+    return 0;
+}
@@ -1,177 +1,343 @@
 #include "ticket.h"
+#include <stdio.h> /* snprintf */
+#include <string.h> /* strcmp */
 
 #define PADDLE_SPEED 550.0
 #define INITIAL_BALL_SPEED 500.0
+#define FPS_UPDATE_INTERVAL 0.25 /* Seconds between FPS overlay updates */
+#define TRAIL_RATE 100.0f /* Trail particles per second */
+#define SPARK_COUNT 24 /* Spark particles per impact */
+#define ENTITY_SNAPSHOT_SIZE (4 * sizeof(float) + 2 * sizeof(Sint16))
+#define GAME_SNAPSHOT_SIZE (3 * ENTITY_SNAPSHOT_SIZE + sizeof(Uint8) + sizeof(float) + 2 * sizeof(Uint16))
+#define REWIND_BUDGET (256 * 1024) /* Bytes of history, several seconds at 300 FPS */
+#define REWIND_KEYFRAME_INTERVAL 60
+#define REWIND_SPEED 2 /* Frames dropped per frame while rewinding */
+#define AI_DEAD_ZONE 8.0f /* Pixels the AI paddle may be off before it moves */
+#define TONE_FREQUENCY 22050 /* Sample rate of the generated sounds */
+#define MAX_TONE_SAMPLES (TONE_FREQUENCY / 2)
 
 typedef enum game_state{
     COUNTDOWN,
     PLAY,
 }game_state_t;
 
-typedef struct entity{
-    float x, y;
-    float dx, dy;
-    int w;
-    int h;
-}entity_t;
+/* A square wave fading out, so that the game needs no sound files */
+static int make_tone(float pitch, float duration)
+{
+    static Sint16 samples[MAX_TONE_SAMPLES];
+    size_t count = (size_t)(duration * TONE_FREQUENCY);
+    size_t period = (size_t)(TONE_FREQUENCY / pitch);
+    size_t i;
+    float amplitude;
+    
+    if (count > MAX_TONE_SAMPLES) count = MAX_TONE_SAMPLES;
+    
+    for (i = 0; i < count; i++){
+        amplitude = 6000.0f * (1.0f - (float)i / (float)count);
+        samples[i] = (Sint16)(((i % period) < period / 2) ? amplitude : -amplitude);
+    }
+    
+    return tk_sound_load_pcm(samples, count, TONE_FREQUENCY);
+}
+
+static void save_entity(tk_snapshot_t *snapshot, tk_world_t *world, tk_entity_t entity)
+{
+    const size_t slot = tk_entity_slot(world, entity);
+    Sint16 w = (Sint16)world->w[slot], h = (Sint16)world->h[slot];
+    
+    tk_snapshot_write(snapshot, &world->x[slot], sizeof(float));
+    tk_snapshot_write(snapshot, &world->y[slot], sizeof(float));
+    tk_snapshot_write(snapshot, &world->dx[slot], sizeof(float));
+    tk_snapshot_write(snapshot, &world->dy[slot], sizeof(float));
+    tk_snapshot_write(snapshot, &w, sizeof(Sint16));
+    tk_snapshot_write(snapshot, &h, sizeof(Sint16));
+}
+
+static void load_entity(tk_snapshot_t *snapshot, tk_world_t *world, tk_entity_t entity)
+{
+    const size_t slot = tk_entity_slot(world, entity);
+    Sint16 w, h;
+    
+    tk_snapshot_read(snapshot, &world->x[slot], sizeof(float));
+    tk_snapshot_read(snapshot, &world->y[slot], sizeof(float));
+    tk_snapshot_read(snapshot, &world->dx[slot], sizeof(float));
+    tk_snapshot_read(snapshot, &world->dy[slot], sizeof(float));
+    tk_snapshot_read(snapshot, &w, sizeof(Sint16));
+    tk_snapshot_read(snapshot, &h, sizeof(Sint16));
+    world->w[slot] = w;
+    world->h[slot] = h;
+}
+
+static void save_game(unsigned char *frame, tk_world_t *world, tk_entity_t p1, tk_entity_t p2, tk_entity_t ball,
+                      game_state_t state, double countdown_timer, int p1_score, int p2_score)
+{
+    tk_snapshot_t snapshot;
+    Uint8 packed_state = (Uint8)state;
+    float packed_timer = (float)countdown_timer;
+    Uint16 packed_scores[2] = { (Uint16)p1_score, (Uint16)p2_score };
+    
+    tk_snapshot_begin(&snapshot, frame, GAME_SNAPSHOT_SIZE);
+    save_entity(&snapshot, world, p1);
+    save_entity(&snapshot, world, p2);
+    save_entity(&snapshot, world, ball);
+    tk_snapshot_write(&snapshot, &packed_state, sizeof(Uint8));
+    tk_snapshot_write(&snapshot, &packed_timer, sizeof(float));
+    tk_snapshot_write(&snapshot, packed_scores, sizeof(packed_scores));
+}
+
+static void load_game(unsigned char *frame, tk_world_t *world, tk_entity_t p1, tk_entity_t p2, tk_entity_t ball,
+                      game_state_t *state, double *countdown_timer, int *p1_score, int *p2_score)
+{
+    tk_snapshot_t snapshot;
+    Uint8 packed_state;
+    float packed_timer;
+    Uint16 packed_scores[2];
+    
+    tk_snapshot_begin(&snapshot, frame, GAME_SNAPSHOT_SIZE);
+    load_entity(&snapshot, world, p1);
+    load_entity(&snapshot, world, p2);
+    load_entity(&snapshot, world, ball);
+    tk_snapshot_read(&snapshot, &packed_state, sizeof(Uint8));
+    tk_snapshot_read(&snapshot, &packed_timer, sizeof(float));
+    tk_snapshot_read(&snapshot, packed_scores, sizeof(packed_scores));
+    *state = (game_state_t)packed_state;
+    *countdown_timer = packed_timer;
+    *p1_score = packed_scores[0];
+    *p2_score = packed_scores[1];
+}
 
 int main(int argc, char *argv[])
 {
-    int i, j;                       /* For looping */
-    double projectile_timer = 0.0;  /* For saving projectile pos at fixed seconds */
-    double countdown_timer;         /* For countdown */
+    double countdown_timer = 0.0;   /* For countdown */
     double dt;                      /* Deltatime */
     game_state_t state = COUNTDOWN; /* Game State */
-    entity_t *projectile;           /* A container of projectiles */
+    tk_world_t *world;              /* Paddles & ball */
+    tk_entity_t p1, p2, ball;       /* Entity handles */
+    size_t l, r, b;                 /* Entity slots of p1, p2 and ball */
+    tk_entity_t hit;                /* Paddle hit by the ball */
+    int hit_sound, wall_sound, score_sound; /* Sound ids, -1 without audio */
+    tk_emitter_t *trail;            /* Particles following the ball */
+    tk_emitter_t *sparks;           /* Particles on impacts */
+    int p1_score = 0, p2_score = 0; /* Scores */
+    char score_text[16];            /* Score display */
+    char fps_text[64] = "";         /* FPS overlay, and the last idle period once there is one */
+    tk_idle_period_t idle_period;   /* Last finished idle period */
+    double fps_timer = 0.0;         /* Time since the FPS overlay was updated */
+    int fps_frames = 0;             /* Frames since the FPS overlay was updated */
+    tk_rewind_t *history;           /* Game state of the last few seconds */
+    unsigned char frame[GAME_SNAPSHOT_SIZE]; /* Serialized game state */
+    bool ai_enabled = false;        /* Left paddle is played by the computer */
+    float ai_target_y;              /* Where the AI wants the center of its paddle */
+    int i;                          /* For looping */
+    
+    /* "--ai" lets the computer play the left paddle */
+    for (i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--ai") == 0){
+            ai_enabled = true;
+        }
+    }
     
     tkmt_srand();
     
     tk_app_init("PongC", 800, 600);
     tk_set_fps_target(300);
     
-    /* Player & ball Initialization */
-    entity_t p1;
-    p1.w = 15;
-    p1.h = 60;
-    p1.x = (float)p1.w;
-    p1.y = (float)((tk_get_window_height() /2) - (p1.w / 2));
-    p1.dx = p1.dy = 0.0;
-    
-    entity_t p2;
-    p2.w = 15;
-    p2.h = 60;
-    p2.x = (float)tk_get_window_width() - (p2.w * 2);
-    p2.y = (float)((tk_get_window_height() /2) - (p2.w / 2));
-    p2.dx = p2.dy = 0.0;
-    
-    entity_t ball;
-    ball.w = ball.h = 15;
-    ball.x = (float)((tk_get_window_width() / 2) - (ball.w / 2));
-    ball.y = (float)((tk_get_window_height() / 2) - (ball.h / 2));
-    ball.dx = 0.0;
-    ball.dy = 0.0;
-    
-    projectile = (entity_t*)tk_darray_create(sizeof(entity_t));
+    /* Player & ball Initialization, paddles stay on screen and are hit by the ball */
+    world = tk_world_create(8);
+    p1 = tk_entity_create(world, 15.0f, (float)((tk_get_window_height() / 2) - (15 / 2)), 15.0f, 60.0f,
+                          RED, TK_ENTITY_CLAMP | TK_ENTITY_SOLID);
+    p2 = tk_entity_create(world, (float)tk_get_window_width() - 30.0f, (float)((tk_get_window_height() / 2) - (15 / 2)),
+                          15.0f, 60.0f, BLUE, TK_ENTITY_CLAMP | TK_ENTITY_SOLID);
+    ball = tk_entity_create(world, (float)((tk_get_window_width() / 2) - (15 / 2)),
+                            (float)((tk_get_window_height() / 2) - (15 / 2)), 15.0f, 15.0f, WHITE, 0);
+    b = tk_entity_slot(world, ball);
+    
+    trail = tk_emitter_create(256);
+    tk_emitter_set_motion(trail, 0.0f, 0.0f, 0.0f, 0.0f, 0.15f, 0.15f);
+    tk_emitter_set_style(trail, (int)world->w[b] - 5, 110, WHITE);
+    
+    sparks = tk_emitter_create(1024);
+    tk_emitter_set_motion(sparks, -250.0f, 250.0f, -250.0f, 250.0f, 0.2f, 0.5f);
+    tk_emitter_set_style(sparks, 3, 255, YELLOW);
+    
+    hit_sound = make_tone(440.0f, 0.08f);
+    wall_sound = make_tone(220.0f, 0.05f);
+    score_sound = make_tone(660.0f, 0.3f);
+    
+    history = tk_rewind_create(GAME_SNAPSHOT_SIZE, REWIND_BUDGET, REWIND_KEYFRAME_INTERVAL);
     
     while (!tk_app_should_quit()){
         dt = tk_get_deltatime();
-        projectile_timer += dt;
+        l = tk_entity_slot(world, p1);
+        r = tk_entity_slot(world, p2);
+        b = tk_entity_slot(world, ball);
         
-        if (state == COUNTDOWN){
-            ball.x = (float)((tk_get_window_width() / 2) - (ball.w / 2));
-            ball.y = (float)((tk_get_window_height() / 2) - (ball.h / 2));
-            ball.dx = ball.dy = 0.0;
-            countdown_timer += dt;
-            if (countdown_timer >= 3){
-                /* Launching a ball */
-                ball.dx = (tkmt_rand(0,1)) ? -1 * INITIAL_BALL_SPEED : INITIAL_BALL_SPEED;
-                ball.dy = tkmt_randf(-150.0, 150.0);
-                state = PLAY;
-                countdown_timer = 0.0;
+        /* Average the frame rate over a short interval, so that the overlay text only changes a few times per second */
+        fps_timer += dt;
+        fps_frames++;
+        if (fps_timer >= FPS_UPDATE_INTERVAL){
+            tk_get_last_idle_period(&idle_period);
+            if (idle_period.index > 0){
+                snprintf(fps_text, sizeof(fps_text), "FPS %d %.2f MS\nIDLE %d %.1f S SAVED %.2f S",
+                         (int)(fps_frames / fps_timer), (fps_timer * 1000.0) / fps_frames,
+                         idle_period.index, idle_period.seconds, idle_period.cpu_saved);
+            }
+            else{
+                snprintf(fps_text, sizeof(fps_text), "FPS %d %.2f MS",
+                         (int)(fps_frames / fps_timer), (fps_timer * 1000.0) / fps_frames);
             }
+            fps_timer = 0.0;
+            fps_frames = 0;
         }
         
-        p1.dy = p2.dy = 0.0;
-        /* Handing the user input */
         if (tk_is_key_down(TK_KEY_ESC)){
             tk_set_should_quit();
         }
-        if (tk_is_key_down(TK_KEY_UP)){
-            p2.dy = -PADDLE_SPEED;
-        }
-        if (tk_is_key_down(TK_KEY_DOWN)){
-            p2.dy = PADDLE_SPEED;
-        }
-        if (tk_is_key_down(TK_KEY_W)){
-            p1.dy = -PADDLE_SPEED;
-        }
-        if (tk_is_key_down(TK_KEY_S)){
-            p1.dy = PADDLE_SPEED;
-        }
         
-        /* update player position */
-        p1.y = tkmt_clampf(p1.y + (p1.dy * dt), 0.0, (float)(tk_get_window_height() - p1.h));
-        p2.y = tkmt_clampf(p2.y + (p2.dy * dt), 0.0, (float)(tk_get_window_height() - p2.h));
-        
-        /* add push 15 old ball positions to darray every 0.1 sec */
-        if (projectile_timer >= 0.01){
-            if (tk_darray_count(projectile) < 15){
-                tk_darray_push((void**)&projectile, &ball);
+        /* Holding R rewinds the game */
+        if (tk_is_key_down(TK_KEY_R) && tk_rewind_count(history) > 1){
+            tk_rewind_step_back(history, REWIND_SPEED, frame);
+            load_game(frame, world, p1, p2, ball, &state, &countdown_timer, &p1_score, &p2_score);
+            tk_emitter_set_rate(trail, 0.0f);
+        }
+        else{
+            if (state == COUNTDOWN){
+                world->x[b] = (float)((tk_get_window_width() / 2) - (world->w[b] / 2));
+                world->y[b] = (float)((tk_get_window_height() / 2) - (world->h[b] / 2));
+                world->dx[b] = world->dy[b] = 0.0;
+                countdown_timer += dt;
+                if (countdown_timer >= 3){
+                    /* Launching a ball */
+                    world->dx[b] = (tkmt_rand(0,1)) ? -1 * INITIAL_BALL_SPEED : INITIAL_BALL_SPEED;
+                    world->dy[b] = tkmt_randf(-150.0, 150.0);
+                    state = PLAY;
+                    countdown_timer = 0.0;
+                }
+            }
+            
+            world->dy[l] = world->dy[r] = 0.0;
+            /* Handing the user input */
+            if (tk_is_key_down(TK_KEY_UP)){
+                world->dy[r] = -PADDLE_SPEED;
+            }
+            if (tk_is_key_down(TK_KEY_DOWN)){
+                world->dy[r] = PADDLE_SPEED;
+            }
+            if (ai_enabled){
+                /* Go where the ball will arrive, or wait in the middle while it moves away */
+                ai_target_y = (float)tk_get_window_height() / 2;
+                if (tkcol_predict_y(world->x[b], world->y[b], world->dx[b], world->dy[b], world->h[b],
+                                    world->x[l] + world->w[l], &ai_target_y)){
+                    ai_target_y += world->h[b] / 2;
+                }
+                if (ai_target_y < world->y[l] + (world->h[l] / 2) - AI_DEAD_ZONE){
+                    world->dy[l] = -PADDLE_SPEED;
+                }
+                else if (ai_target_y > world->y[l] + (world->h[l] / 2) + AI_DEAD_ZONE){
+                    world->dy[l] = PADDLE_SPEED;
+                }
             }
             else{
-                tk_darray_push((void**)&projectile, &ball);
-                tk_darray_erase_at((void*)projectile, 0);
+                if (tk_is_key_down(TK_KEY_W)){
+                    world->dy[l] = -PADDLE_SPEED;
+                }
+                if (tk_is_key_down(TK_KEY_S)){
+                    world->dy[l] = PADDLE_SPEED;
+                }
+            }
+            
+            /* Update player & ball positions */
+            tk_world_move(world, dt);
+            tk_world_clamp(world, 0.0f, 0.0f, (float)tk_get_window_width(), (float)tk_get_window_height());
+            
+            /* The trail follows the ball while it is in play */
+            tk_emitter_set_position(trail, world->x[b] + (world->w[b] / 2), world->y[b] + (world->h[b] / 2));
+            tk_emitter_set_rate(trail, (state == PLAY) ? TRAIL_RATE : 0.0f);
+            
+            /*=== Handling collision ===*/
+            /* VS vertical walls */
+            if (world->y[b] < 0 || world->y[b] + world->h[b] >= tk_get_window_height()){
+                world->dy[b] *= -1;
+                tk_sound_play(wall_sound, 0.6f);
+                tk_emitter_set_position(sparks, world->x[b] + (world->w[b] / 2),
+                                        (world->y[b] < 0) ? 0.0f : (float)tk_get_window_height());
+                tk_emitter_burst(sparks, SPARK_COUNT);
             }
-            projectile_timer = 0.0;
+            /* VS horizontal walls */
+            if (world->x[b] + world->w[b] < 0){
+                p2_score++;
+                state = COUNTDOWN;
+                tk_sound_play(score_sound, 0.8f);
+            }
+            else if (world->x[b] >= tk_get_window_width()){
+                p1_score++;
+                state = COUNTDOWN;
+                tk_sound_play(score_sound, 0.8f);
+            }
+            
+            /* vs paddles */
+            if (tk_world_collide(world, ball, &hit, 1))
+            {
+                world->x[b] = (hit == p2) ? (world->x[r] - (world->w[b])) -5 : (world->x[l] + world->w[l]) + 5;
+                world->dx[b] *= -1.02;
+                world->dy[b] = (world->dy[b] < 0) ? tkmt_randf(-350, 0) : tkmt_randf(0, 350);
+                tk_sound_play(hit_sound, 0.8f);
+                tk_emitter_set_position(sparks, (world->dx[b] > 0) ? world->x[b] : world->x[b] + world->w[b],
+                                        world->y[b] + (world->h[b] / 2));
+                tk_emitter_burst(sparks, SPARK_COUNT);
+            }
+            
+            /* Record the frame */
+            save_game(frame, world, p1, p2, ball, state, countdown_timer, p1_score, p2_score);
+            tk_rewind_push(history, frame);
         }
         
+        tk_emitter_update(trail, dt);
+        tk_emitter_update(sparks, dt);
         
-        /* Update ball position */
-        ball.y += ball.dy * dt;
-        ball.x += ball.dx * dt;
-        
-        /*=== Handling collision ===*/
-        /* VS vertical walls */
-        if (ball.y < 0 || ball.y + ball.h >= tk_get_window_height()){
-            ball.dy *= -1;
-        }
-        /* VS horizontal walls */
-        if (ball.x + ball.w < 0 || ball.x >= tk_get_window_width()){
-            state = COUNTDOWN;
-        }
-        
-        /* vs paddles */
-        if (tkcol_rect_vs_rect(p1.x, p1.y, p1.w, p1.h, ball.x, ball.y, ball.w, ball.h) ||
-            tkcol_rect_vs_rect(p2.x, p2.y, p2.w, p2.h, ball.x, ball.y, ball.w,ball.h))
-        {
-            ball.x = (ball.x >= tk_get_window_width() / 2) ? (p2.x - (ball.w)) -5 : (p1.x + p1.w) + 5;
-            ball.dx *= -1.02;
-            ball.dy = (ball.dy < 0) ? tkmt_randf(-350, 0) : tkmt_randf(0, 350);
-        }
+        /* Nothing moves during the count down once the paddles stopped and the sparks faded, save the CPU */
+        tk_set_idle(state == COUNTDOWN && !tk_is_key_down(TK_KEY_R) &&
+                    world->dy[l] == 0.0f && world->dy[r] == 0.0f && trail->count == 0 && sparks->count == 0);
         
         /* === Rendering === */
         tk_clear_screen(BLACK);
         tk_draw_line(tk_get_window_width() / 2, 0,
                      tk_get_window_width() / 2, tk_get_window_height(), PEARL);
+        /* Drawing scores */
+        snprintf(score_text, sizeof(score_text), "%d", p1_score);
+        tk_draw_text(score_text, (tk_get_window_width() / 2) - 40 - tk_get_text_width(score_text, 6), 20, 6, PEARL);
+        snprintf(score_text, sizeof(score_text), "%d", p2_score);
+        tk_draw_text(score_text, (tk_get_window_width() / 2) + 40, 20, 6, PEARL);
+        
         /* Drawing count down */
         if (state == COUNTDOWN){
-            int i, j;
             const int middle_w = tk_get_window_width() / 2;
             const int middle_h = tk_get_window_height() / 2;
-            const int square_size = 15;
-            if (countdown_timer > 0 && countdown_timer <= 1){
-                for (i = 0, j = -1; i < 3; i++, j++){
-                    tk_draw_rect(middle_w - (square_size / 2) + (j * (square_size * 2)), 
-                                 middle_h + (square_size * 2),
-                                 square_size, square_size, GREEN);
-                }
-            }
-            else if (countdown_timer > 1 && countdown_timer <= 2){
-                for (i = 0, j = -1; i < 2; i++, j++){
-                    tk_draw_rect(middle_w - (square_size / 2) + (j * (square_size * 2)), 
-                                 middle_h + (square_size * 2),
-                                 square_size, square_size, GREEN);
-                }
-            }
-            else if (countdown_timer > 2 && countdown_timer <= 3){
-                tk_draw_rect(middle_w - (square_size / 2) - (square_size * 2), 
-                             middle_h + (square_size * 2),
-                             square_size, square_size, GREEN);
+            const int digit_scale = 8;
+            char countdown_text[2];
+            if (countdown_timer < 3){
+                countdown_text[0] = (char)('3' - (int)countdown_timer);
+                countdown_text[1] = '\0';
+                tk_draw_text(countdown_text, middle_w - (tk_get_text_width(countdown_text, digit_scale) / 2),
+                             middle_h + (digit_scale * 4), digit_scale, GREEN);
             }
         }
         
-        /* Drawing paddles */
-        tk_draw_rect(p1.x, p1.y, p1.w, p1.h, RED);
-        tk_draw_rect(p2.x, p2.y, p2.w, p2.h, BLUE);
-        /* Drawing projectile */
-        for (i = tk_darray_count(projectile), j = 0; i >= 0 ; i--, j += 5){
-            tk_draw_rect_a(projectile[i].x, projectile[i].y, projectile[i].w - 5, projectile[i].h, 110 - j,WHITE);
-        }
-        /* Drawing a ball */
-        tk_draw_rect(ball.x, ball.y, ball.w, ball.h, WHITE);
+        /* Drawing FPS overlay */
+        tk_draw_text(fps_text, 10, 10, 2, GRAY);
+        
+        /* Drawing particles */
+        tk_emitter_draw(trail);
+        tk_emitter_draw(sparks);
+        /* Drawing paddles & ball */
+        tk_world_draw(world);
         tk_end_drawing();
     }
     
+    tk_emitter_destroy(trail);
+    tk_emitter_destroy(sparks);
+    tk_rewind_destroy(history);
+    tk_world_destroy(world);
     tk_app_destroy();
     
     return 0;
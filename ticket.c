@@ -1,8 +1,11 @@
+#define TICKET_C /* The create functions are defined here, see "Allocation sites" in ticket.h */
 #include "ticket.h"
-#include <time.h> /* time */
+#include <time.h> /* time, clock */
 #include <stdlib.h> /* malloc, exit, size_t, rand*/
 #include <string.h> /* memset, memcpy */
 #include <stdio.h> /* printf */
+#include <stdint.h> /* intptr_t */
+#include <math.h> /* floorf */
 
 /* Internal Structs */
 typedef struct key_state{
@@ -12,6 +15,7 @@ typedef struct key_state{
     bool key_w;
     bool key_s;
     bool key_esc;
+    bool key_r;
 }key_state_t;
 
 typedef struct app{
@@ -19,22 +23,362 @@ typedef struct app{
     SDL_Renderer *renderer;
     int window_width, window_height;
     int fps_cap;
+    int worker_count;
+    size_t frame_arena_size;
+    bool frame_arena_double_buffered;
+    int audio_buffer_size;
     double deltatime;
     bool should_quit;
+    
+    /* Idle mode */
+    int idle_fps;
+    bool minimized, unfocused, idle_requested;
+    bool idle;                 /* Any of the above */
+    Uint64 period_start;       /* Performance counter at the start of the current idle or active period */
+    clock_t period_start_cpu;  /* CPU time at the start of the current period */
+    double active_cpu_ratio;   /* CPU seconds per second measured while active */
+    double idle_cpu_saved;     /* Total CPU seconds saved by idling */
+    tk_idle_period_t last_idle_period;
 }app_t;
 
+#define DEFAULT_IDLE_FPS 10
+#define MIN_ACTIVE_PERIOD 0.25 /* Seconds, shorter active periods are too noisy to measure the CPU usage */
+
+#define JOB_QUEUE_CAPACITY 1024 /* Must be a power of 2 */
+#define JOB_SPIN_COUNT 256 /* Number of empty tries before a worker goes to sleep */
+
+typedef struct job{
+    tk_job_fn fn;
+    tk_job_range_fn range_fn; /* Used instead of fn for parallel for jobs */
+    void *data;
+    size_t begin, end;
+    tk_job_counter_t *counter;
+    tk_job_counter_t *dependency;
+}job_t;
+
+TK_DARRAY(job_t)
+
+typedef struct job_queue{ /* A per worker deque. The owner uses the tail, thieves use the head */
+    SDL_SpinLock lock;
+    size_t head, tail;
+    job_t jobs[JOB_QUEUE_CAPACITY];
+}job_queue_t;
+
+typedef struct job_system{
+    SDL_Thread **threads;
+    job_queue_t *queues; /* queues[0] belongs to the main thread, queues[i] to threads[i - 1] */
+    int worker_count;
+    SDL_TLSID tls; /* Holds queue index + 1 of the current thread */
+    SDL_sem *wake;
+    SDL_atomic_t sleeping;
+    SDL_atomic_t quit;
+    SDL_SpinLock deferred_lock;
+    SDL_atomic_t deferred_count;
+    job_t *deferred; /* darray of jobs waiting for their dependency */
+}job_system_t;
+
+#define DEFAULT_FRAME_ARENA_SIZE (1024 * 1024)
+#define FRAME_ARENA_ALIGNMENT 16
+
+typedef struct frame_arena{
+    char *blocks[2]; /* blocks[1] is only used when double buffered */
+    size_t size;
+    int current;
+    bool double_buffered;
+    SDL_atomic_t offset; /* Atomic, so that jobs can allocate too */
+    size_t high_water;
+}frame_arena_t;
+
+#define MAX_SOUNDS 32
+#define MAX_VOICES 32 /* Sounds playing at the same time */
+#define AUDIO_QUEUE_CAPACITY 64 /* Must be a power of 2 */
+#define AUDIO_FREQUENCY 44100
+#define DEFAULT_AUDIO_BUFFER_SIZE 512
+#define AUDIO_MIX_CHUNK 256 /* Sample frames mixed at once */
+
+typedef struct sound{ /* 16 bit mono at AUDIO_FREQUENCY */
+    Sint16 *samples;
+    size_t length;
+}sound_t;
+
+typedef struct voice{
+    const Sint16 *samples; /* NULL = free voice */
+    size_t length, position;
+    int volume; /* 0 to 256 */
+}voice_t;
+
+typedef struct audio_queue{ /* Play requests, single producer (game thread), single consumer (audio callback) */
+    voice_t requests[AUDIO_QUEUE_CAPACITY];
+    SDL_atomic_t head; /* Next request to read, only written by the callback */
+    SDL_atomic_t tail; /* Next request to write, only written by the game thread */
+}audio_queue_t;
+
+typedef struct audio{
+    SDL_AudioDeviceID device; /* 0 = no audio */
+    sound_t sounds[MAX_SOUNDS]; /* Only touched by the game thread */
+    int sound_count;
+    audio_queue_t queue;
+    voice_t voices[MAX_VOICES]; /* Only touched by the callback */
+    Sint32 mix[AUDIO_MIX_CHUNK];
+}audio_t;
+
+#define MAX_ATLASES 8
+#define ATLAS_PADDING 1 /* Empty pixels between sprites, so that neighbours do not bleed */
+
+typedef struct sprite{
+    int atlas;
+    float u0, v0, u1, v1; /* Texture coordinates of the sub rect */
+}sprite_t;
+
+typedef struct atlas{
+    SDL_Texture *texture;
+    int width, height;
+    int shelf_x, shelf_y, shelf_height; /* Sprites are packed left to right in rows (shelves) */
+}atlas_t;
+
+TK_DARRAY(sprite_t)
+TK_DARRAY(SDL_Vertex)
+TK_DARRAY(int)
+
+typedef struct sprite_batch{ /* Sprites waiting to be submitted, all from the same atlas */
+    int atlas;
+    SDL_Vertex *vertices;
+    int *indices;
+}sprite_batch_t;
+
+#define FONT_FIRST_CHAR ' '
+#define FONT_GLYPH_COUNT 64 /* ' ' to '_', lower case letters are drawn upper case */
+#define FONT_GLYPH_WIDTH 5
+#define FONT_GLYPH_HEIGHT 7
+#define FONT_ADVANCE 6
+#define FONT_LINE_HEIGHT 9
+#define FONT_ATLAS_WIDTH 128
+#define FONT_ATLAS_HEIGHT 64
+#define TEXT_CACHE_SIZE 32
+#define TEXT_CACHE_MAX_LENGTH 128
+
+typedef struct font{
+    int atlas;
+    int first_sprite; /* The glyphs are consecutive sprites, starting with FONT_FIRST_CHAR */
+}font_t;
+
+typedef struct text_cache_entry{ /* Laid out quads of a string drawn recently */
+    char text[TEXT_CACHE_MAX_LENGTH];
+    Uint32 hash;
+    int x, y, scale;
+    SDL_Color color;
+    Uint64 last_used;
+    SDL_Vertex *vertices;
+}text_cache_entry_t;
+
+/* 5x7 glyphs, one byte per row, bit 4 is the left most column */
+static const Uint8 font_glyphs[FONT_GLYPH_COUNT][FONT_GLYPH_HEIGHT] = {
+    {0x00,0x00,0x00,0x00,0x00,0x00,0x00}, /* ' ' */
+    {0x04,0x04,0x04,0x04,0x04,0x00,0x04}, /* '!' */
+    {0x0A,0x0A,0x0A,0x00,0x00,0x00,0x00}, /* '"' */
+    {0x0A,0x0A,0x1F,0x0A,0x1F,0x0A,0x0A}, /* '#' */
+    {0x04,0x0F,0x14,0x0E,0x05,0x1E,0x04}, /* '$' */
+    {0x18,0x19,0x02,0x04,0x08,0x13,0x03}, /* '%' */
+    {0x0C,0x12,0x14,0x08,0x15,0x12,0x0D}, /* '&' */
+    {0x0C,0x04,0x08,0x00,0x00,0x00,0x00}, /* ''' */
+    {0x02,0x04,0x08,0x08,0x08,0x04,0x02}, /* '(' */
+    {0x08,0x04,0x02,0x02,0x02,0x04,0x08}, /* ')' */
+    {0x00,0x04,0x15,0x0E,0x15,0x04,0x00}, /* '*' */
+    {0x00,0x04,0x04,0x1F,0x04,0x04,0x00}, /* '+' */
+    {0x00,0x00,0x00,0x00,0x0C,0x04,0x08}, /* ',' */
+    {0x00,0x00,0x00,0x1F,0x00,0x00,0x00}, /* '-' */
+    {0x00,0x00,0x00,0x00,0x00,0x0C,0x0C}, /* '.' */
+    {0x00,0x01,0x02,0x04,0x08,0x10,0x00}, /* '/' */
+    {0x0E,0x11,0x13,0x15,0x19,0x11,0x0E}, /* '0' */
+    {0x04,0x0C,0x04,0x04,0x04,0x04,0x0E}, /* '1' */
+    {0x0E,0x11,0x01,0x02,0x04,0x08,0x1F}, /* '2' */
+    {0x1F,0x02,0x04,0x02,0x01,0x11,0x0E}, /* '3' */
+    {0x02,0x06,0x0A,0x12,0x1F,0x02,0x02}, /* '4' */
+    {0x1F,0x10,0x1E,0x01,0x01,0x11,0x0E}, /* '5' */
+    {0x06,0x08,0x10,0x1E,0x11,0x11,0x0E}, /* '6' */
+    {0x1F,0x01,0x02,0x04,0x08,0x08,0x08}, /* '7' */
+    {0x0E,0x11,0x11,0x0E,0x11,0x11,0x0E}, /* '8' */
+    {0x0E,0x11,0x11,0x0F,0x01,0x02,0x0C}, /* '9' */
+    {0x00,0x0C,0x0C,0x00,0x0C,0x0C,0x00}, /* ':' */
+    {0x00,0x0C,0x0C,0x00,0x0C,0x04,0x08}, /* ';' */
+    {0x02,0x04,0x08,0x10,0x08,0x04,0x02}, /* '<' */
+    {0x00,0x00,0x1F,0x00,0x1F,0x00,0x00}, /* '=' */
+    {0x08,0x04,0x02,0x01,0x02,0x04,0x08}, /* '>' */
+    {0x0E,0x11,0x01,0x02,0x04,0x00,0x04}, /* '?' */
+    {0x0E,0x11,0x01,0x0D,0x15,0x15,0x0E}, /* '@' */
+    {0x0E,0x11,0x11,0x11,0x1F,0x11,0x11}, /* 'A' */
+    {0x1E,0x11,0x11,0x1E,0x11,0x11,0x1E}, /* 'B' */
+    {0x0E,0x11,0x10,0x10,0x10,0x11,0x0E}, /* 'C' */
+    {0x1C,0x12,0x11,0x11,0x11,0x12,0x1C}, /* 'D' */
+    {0x1F,0x10,0x10,0x1E,0x10,0x10,0x1F}, /* 'E' */
+    {0x1F,0x10,0x10,0x1E,0x10,0x10,0x10}, /* 'F' */
+    {0x0E,0x11,0x10,0x17,0x11,0x11,0x0F}, /* 'G' */
+    {0x11,0x11,0x11,0x1F,0x11,0x11,0x11}, /* 'H' */
+    {0x0E,0x04,0x04,0x04,0x04,0x04,0x0E}, /* 'I' */
+    {0x07,0x02,0x02,0x02,0x02,0x12,0x0C}, /* 'J' */
+    {0x11,0x12,0x14,0x18,0x14,0x12,0x11}, /* 'K' */
+    {0x10,0x10,0x10,0x10,0x10,0x10,0x1F}, /* 'L' */
+    {0x11,0x1B,0x15,0x15,0x11,0x11,0x11}, /* 'M' */
+    {0x11,0x11,0x19,0x15,0x13,0x11,0x11}, /* 'N' */
+    {0x0E,0x11,0x11,0x11,0x11,0x11,0x0E}, /* 'O' */
+    {0x1E,0x11,0x11,0x1E,0x10,0x10,0x10}, /* 'P' */
+    {0x0E,0x11,0x11,0x11,0x15,0x12,0x0D}, /* 'Q' */
+    {0x1E,0x11,0x11,0x1E,0x14,0x12,0x11}, /* 'R' */
+    {0x0F,0x10,0x10,0x0E,0x01,0x01,0x1E}, /* 'S' */
+    {0x1F,0x04,0x04,0x04,0x04,0x04,0x04}, /* 'T' */
+    {0x11,0x11,0x11,0x11,0x11,0x11,0x0E}, /* 'U' */
+    {0x11,0x11,0x11,0x11,0x11,0x0A,0x04}, /* 'V' */
+    {0x11,0x11,0x11,0x15,0x15,0x15,0x0A}, /* 'W' */
+    {0x11,0x11,0x0A,0x04,0x0A,0x11,0x11}, /* 'X' */
+    {0x11,0x11,0x11,0x0A,0x04,0x04,0x04}, /* 'Y' */
+    {0x1F,0x01,0x02,0x04,0x08,0x10,0x1F}, /* 'Z' */
+    {0x0E,0x08,0x08,0x08,0x08,0x08,0x0E}, /* '[' */
+    {0x00,0x10,0x08,0x04,0x02,0x01,0x00}, /* '\' */
+    {0x0E,0x02,0x02,0x02,0x02,0x02,0x0E}, /* ']' */
+    {0x04,0x0A,0x11,0x00,0x00,0x00,0x00}, /* '^' */
+    {0x00,0x00,0x00,0x00,0x00,0x00,0x1F}, /* '_' */
+};
+
+#define REWIND_BYTES_PER_RECORD 64 /* Part of the rewind budget spent on the record table */
+
+typedef struct rewind_record{
+    size_t offset; /* Where the encoded frame starts in the data ring */
+    size_t size;
+    bool keyframe;
+}rewind_record_t;
+
+struct tk_rewind{
+    size_t frame_size;
+    int keyframe_interval;
+    int frames_since_keyframe;
+    
+    unsigned char *data;      /* Ring of encoded frames, each one contiguous */
+    size_t data_capacity;
+    size_t head;              /* Where the next frame goes */
+    
+    rewind_record_t *records; /* Ring of records, oldest first */
+    size_t record_capacity;
+    size_t first, count;
+    
+    unsigned char *latest;    /* The newest frame, deltas are made against it */
+    unsigned char *encoded;   /* Scratch space for encoding a frame */
+};
+
+#define HASHMAP_MIN_CAPACITY 16 /* Must be a power of 2 */
+#define HASHMAP_MAX_LOAD_NUM 7  /* Grow when more than 7 / 8 of the slots are used */
+#define HASHMAP_MAX_LOAD_DEN 8
+
+struct tk_hashmap{
+    size_t key_size, item_size;
+    size_t capacity; /* Always a power of 2 */
+    size_t count;
+    Uint32 *hashes;  /* 0 = empty slot */
+    char *keys;
+    char *items;
+    char *carry;     /* A key and item moved around while inserting, then a swap space of the same size */
+};
+
+#define ENTITY_INDEX_BITS 20
+#define ENTITY_INDEX_MASK ((1u << ENTITY_INDEX_BITS) - 1)
+#define ENTITY_GENERATION_MASK 0xFFF /* 12 bits left in a handle */
+
+/*
+Every container allocation goes through these. MEM_ALLOC_AT charges the caller of a create function,
+MEM_ALLOC_LIKE charges the site of a block already allocated for the same container (growth, nodes),
+MEM_ALLOC charges the ticket.c function itself.
+*/
+#define MEM_ALLOC(size) _mem_alloc((size), __func__, 0)
+#define MEM_ALLOC_AT(size, file, line) _mem_alloc((size), (file), (line))
+#define MEM_ALLOC_LIKE(size, ptr) _mem_alloc_like((size), (ptr), __func__)
+#define MEM_FREE(ptr) _mem_free(ptr)
+#define MAX_ALLOC_SITES 64
+
+#ifdef TK_TRACK_ALLOCATIONS
+typedef struct alloc_header{ /* Put in front of every tracked allocation, 16 bytes to keep the alignment */
+    size_t size;
+    size_t site;
+}alloc_header_t;
+
+typedef struct alloc_site{
+    const char *name; /* A file, or a function when line is 0 */
+    int line;
+    tk_alloc_stats_t stats;
+}alloc_site_t;
+#endif
+
 /* Globals */
 static app_t app;
+static tk_allocator_t allocator;
+#ifdef TK_TRACK_ALLOCATIONS
+static SDL_SpinLock alloc_lock;
+static tk_alloc_stats_t alloc_stats;
+static alloc_site_t alloc_sites[MAX_ALLOC_SITES];
+static size_t alloc_site_count;
+#endif
+static atlas_t atlases[MAX_ATLASES];
+static int atlas_count;
+static sprite_t *sprites;
+static sprite_batch_t sprite_batch;
+static font_t font;
+static text_cache_entry_t text_cache[TEXT_CACHE_SIZE];
+static Uint64 text_cache_clock;
+static SDL_Vertex *text_scratch; /* Layout of strings too long to cache */
+static frame_arena_t frame_arena;
+static job_system_t job_system;
+static audio_t audio;
 static key_state_t key_state;
 static Uint64 now;
 static Uint64 last;
 
 /* Internal function prototypes */
+static void* _mem_alloc(size_t size, const char *name, int line);
+static void* _mem_alloc_like(size_t size, const void *like, const char *name);
+#ifdef TK_TRACK_ALLOCATIONS
+static void* _mem_alloc_tracked(size_t size, size_t site);
+#endif
+static void _mem_free(void *ptr);
+static int _atlas_add(int atlas, const void *pixels, int width, int height, int pitch);
 static void _set_key_state(SDL_Scancode scancode, bool is_down);
 static void _cap_fps(int fps);
 static void _hex_to_rgba(char *hex, int* rgba);
+static float _fold_y(float y, float range);
 static void _update_key_state(void);
+static void _handle_event(const SDL_Event *event);
+static void _update_idle(void);
+static void _wait_idle(int fps);
 static void _calculate_deltatime(void);
+static void _flush_sprite_batch(void);
+static SDL_Color _hex_to_color(char *hex, int alpha);
+static void _make_sprite_quad(const sprite_t *s, float x, float y, float w, float h, SDL_Color color, SDL_Vertex *quad);
+static void _sprite_batch_append(int atlas, const SDL_Vertex *quads, size_t vertex_count);
+static float _emitter_randf(tk_emitter_t *emitter, float min, float max);
+static void _emitter_integrate(float *restrict x, float *restrict y, const float *restrict dx, const float *restrict dy,
+                               float *restrict life, size_t count, float dt);
+static size_t _rewind_encode_delta(tk_rewind_t *rewind, const unsigned char *frame);
+static void _rewind_apply_delta(unsigned char *frame, const unsigned char *delta, size_t size);
+static bool _rewind_find_space(tk_rewind_t *rewind, size_t size, size_t *offset);
+static void _rewind_drop_oldest(tk_rewind_t *rewind);
+static void _integrate_axis(float *restrict position, const float *restrict velocity, size_t count, float dt);
+static void _build_quad_indices(int *indices, size_t first_vertex, size_t quad_count);
+static tk_entity_t _entity_handle(tk_world_t *world, Uint32 index);
+static Uint32 _fnv1a(const void *data, size_t size);
+static Uint32 _hashmap_hash(const tk_hashmap_t *map, const void *key);
+static size_t _hashmap_find_slot(const tk_hashmap_t *map, const void *key, Uint32 hash);
+static size_t _hashmap_place(tk_hashmap_t *map, const void *key, const void *item, Uint32 hash);
+static void _hashmap_rehash(tk_hashmap_t *map, size_t capacity);
+static void _font_init(void);
+static void _font_destroy(void);
+static void _layout_text(const char *text, int x, int y, int scale, SDL_Color color, SDL_Vertex **vertices);
+static text_cache_entry_t* _text_cache_get(const char *text, size_t length, int x, int y, int scale, SDL_Color color);
+static void _frame_arena_init(size_t size, bool double_buffered);
+static void _frame_arena_destroy(void);
+static void _frame_arena_reset(void);
+static void _job_system_init(int worker_count);
+static void _job_system_destroy(void);
+static void _audio_init(int buffer_size);
+static void _audio_destroy(void);
+static void _audio_callback(void *userdata, Uint8 *stream, int length);
+static int _sound_add(SDL_AudioFormat format, Uint8 channels, int frequency, const Uint8 *data, Uint32 size);
 
 /*=== App init & destruction functions ===*/
 void tk_app_init(char *title, int window_width, int window_height)
@@ -64,15 +408,51 @@ void tk_app_init(char *title, int window_width, int window_height)
     app.window_width = window_width;
     app.window_height = window_height;
     
+    sprites = sprite_t_darray_create();
+    sprite_batch.vertices = SDL_Vertex_darray_create();
+    sprite_batch.indices = int_darray_create();
+    _font_init();
+    
+    _frame_arena_init(app.frame_arena_size ? app.frame_arena_size : DEFAULT_FRAME_ARENA_SIZE,
+                      app.frame_arena_double_buffered);
+    _job_system_init(app.worker_count);
+    _audio_init(app.audio_buffer_size ? app.audio_buffer_size : DEFAULT_AUDIO_BUFFER_SIZE);
+    
     /* Start counting timer */
     now = SDL_GetPerformanceCounter();
+    app.period_start = now;
+    app.period_start_cpu = clock();
 }
 
 void tk_app_destroy(void)
 {
+    int i;
+    
+    /* End a running idle period, so that it is reported too */
+    app.minimized = app.unfocused = app.idle_requested = false;
+    _update_idle();
+    
+    _audio_destroy();
+    _job_system_destroy();
+    _frame_arena_destroy();
+    
+    _font_destroy();
+    for (i = 0; i < atlas_count; i++){
+        SDL_DestroyTexture(atlases[i].texture);
+    }
+    atlas_count = 0;
+    sprite_t_darray_destroy(sprites);
+    SDL_Vertex_darray_destroy(sprite_batch.vertices);
+    int_darray_destroy(sprite_batch.indices);
+    
     SDL_DestroyWindow(app.window);
     SDL_DestroyRenderer(app.renderer);
     SDL_Quit();
+    
+#ifdef TK_TRACK_ALLOCATIONS
+    /* Everything allocated by ticket.c is freed by now, whatever is left leaked */
+    tk_print_alloc_report();
+#endif
 }
 
 /* === Add data getters === */
@@ -96,6 +476,21 @@ double tk_get_deltatime(void)
     return app.deltatime;
 }
 
+bool tk_is_idle(void)
+{
+    return app.idle;
+}
+
+double tk_get_idle_cpu_saved(void)
+{
+    return app.idle_cpu_saved;
+}
+
+void tk_get_last_idle_period(tk_idle_period_t *period)
+{
+    *period = app.last_idle_period;
+}
+
 /* === App data setters === */
 void tk_set_fps_target(int fps){
     app.fps_cap = fps;
@@ -106,6 +501,32 @@ void tk_set_should_quit(void)
     app.should_quit = true;
 }
 
+void tk_set_idle(bool idle)
+{
+    app.idle_requested = idle;
+}
+
+void tk_set_idle_fps(int fps)
+{
+    app.idle_fps = fps;
+}
+
+void tk_set_worker_count(int count)
+{
+    app.worker_count = count;
+}
+
+void tk_set_frame_arena(size_t size, bool double_buffered)
+{
+    app.frame_arena_size = size;
+    app.frame_arena_double_buffered = double_buffered;
+}
+
+void tk_set_audio_buffer_size(int samples)
+{
+    app.audio_buffer_size = samples;
+}
+
 /* === Input Related functions ===*/
 bool tk_is_key_down(tk_key_id_t key){
     switch (key){
@@ -114,6 +535,7 @@ bool tk_is_key_down(tk_key_id_t key){
         case TK_KEY_W:{ return key_state.key_w; }break;
         case TK_KEY_S:{ return key_state.key_s; }break;
         case TK_KEY_ESC:{ return key_state.key_esc; }break;
+        case TK_KEY_R:{ return key_state.key_r; }break;
         default: { return 0; }break;
     }
 }
@@ -122,6 +544,7 @@ bool tk_is_key_down(tk_key_id_t key){
 void tk_clear_screen(char *color)
 {
     int rgba[3];
+    _flush_sprite_batch();
     _hex_to_rgba(color, rgba);
     SDL_SetRenderDrawColor(app.renderer, rgba[0], rgba[1], rgba[2], 255);
     SDL_RenderClear(app.renderer);
@@ -130,6 +553,7 @@ void tk_clear_screen(char *color)
 void tk_draw_rect(int x, int y, int w, int h, char *color)
 {
     int rgba[3];
+    _flush_sprite_batch();
     _hex_to_rgba(color, rgba);
     SDL_SetRenderDrawColor(app.renderer, rgba[0], rgba[1], rgba[2], 255);
     SDL_RenderFillRect(app.renderer, &((SDL_Rect){x, y, w, h}));
@@ -138,6 +562,7 @@ void tk_draw_rect(int x, int y, int w, int h, char *color)
 void tk_draw_rect_a(int x, int y, int w, int h, int alpha, char *color)
 {
     int rgba[3];
+    _flush_sprite_batch();
     _hex_to_rgba(color, rgba);
     SDL_SetRenderDrawColor(app.renderer, rgba[0], rgba[1], rgba[2], alpha);
     SDL_RenderFillRect(app.renderer, &((SDL_Rect){x, y, w, h}));
@@ -146,386 +571,2384 @@ void tk_draw_rect_a(int x, int y, int w, int h, int alpha, char *color)
 void tk_draw_line(int x1, int y1, int x2, int y2, char *color)
 {
     int rgba[3];
+    _flush_sprite_batch();
     _hex_to_rgba(color, rgba);
     SDL_SetRenderDrawColor(app.renderer, rgba[0], rgba[1], rgba[2], 255);
     SDL_RenderDrawLine(app.renderer, x1, y1, x2, y2);
 }
 
 void tk_end_drawing(void){
-    SDL_RenderPresent(app.renderer);
-    _cap_fps(app.fps_cap);
+    bool window_inactive;
+    
+    _flush_sprite_batch();
+    _update_idle();
+    window_inactive = app.minimized || app.unfocused;
+    /* Nothing would be shown while minimized */
+    if (!app.minimized){
+        SDL_RenderPresent(app.renderer);
+    }
+    _frame_arena_reset();
+    if (app.idle){
+        _wait_idle(app.idle_fps ? app.idle_fps : DEFAULT_IDLE_FPS);
+    }
+    else{
+        _cap_fps(app.fps_cap);
+    }
     _calculate_deltatime();
     _update_key_state();
+    
+    /* Stop the game while the window is inactive, stepping through long idle frames would skip over collisions */
+    /* The frame coming back from an inactive wait is just as long, so it is stopped too */
+    if (window_inactive || app.unfocused){
+        app.deltatime = 0.0;
+    }
 }
 
-/* === Math functions === */
-int tkmt_clamp(int value_to_clamp, int min, int max)
+/* === Texture functions === */
+int tk_atlas_create(int width, int height)
 {
-    if (value_to_clamp < min) 
-        return  min;
-    if (value_to_clamp > max)
-        return max;
+    atlas_t *atlas;
     
-    return value_to_clamp;
+    if (atlas_count >= MAX_ATLASES) return -1;
+    
+    atlas = &atlases[atlas_count];
+    memset(atlas, 0, sizeof(atlas_t));
+    atlas->texture = SDL_CreateTexture(app.renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, width, height);
+    if (!atlas->texture){
+        printf("Could not create atlas texture: %s\n", SDL_GetError());
+        return -1;
+    }
+    SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+    
+    atlas->width = width;
+    atlas->height = height;
+    
+    return atlas_count++;
 }
 
-float tkmt_clampf(float value_to_clamp, float min, float max)
+int tk_sprite_load(int atlas, const char *path)
 {
-    if (value_to_clamp < min) 
-        return  min;
-    if (value_to_clamp > max)
-        return max;
+    SDL_Surface *loaded, *converted;
+    int sprite;
     
-    return value_to_clamp;
+    loaded = SDL_LoadBMP(path);
+    if (!loaded){
+        printf("Could not load %s: %s\n", path, SDL_GetError());
+        return -1;
+    }
+    
+    converted = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(loaded);
+    if (!converted){
+        printf("Could not convert %s: %s\n", path, SDL_GetError());
+        return -1;
+    }
+    
+    SDL_LockSurface(converted);
+    sprite = _atlas_add(atlas, converted->pixels, converted->w, converted->h, converted->pitch);
+    SDL_UnlockSurface(converted);
+    SDL_FreeSurface(converted);
+    
+    return sprite;
 }
 
-void tkmt_srand(void)
+int tk_sprite_load_rgba(int atlas, const void *pixels, int width, int height)
 {
-    srand((unsigned int)time(NULL));
+    return _atlas_add(atlas, pixels, width, height, width * 4);
 }
 
-int tkmt_rand(int min, int max){
-    return min + (int)(rand() * (max - min + 1) / (1 + RAND_MAX));
+void tk_draw_sprite(int sprite, int x, int y, int w, int h, int alpha, char *tint)
+{
+    const sprite_t *s;
+    SDL_Vertex quad[4];
+    
+    /* -1 from a failed load is quietly not drawn */
+    if (sprite < 0 || (size_t)sprite >= sprite_t_darray_count(sprites)) return;
+    s = &sprites[sprite];
+    
+    _make_sprite_quad(s, (float)x, (float)y, (float)w, (float)h, _hex_to_color(tint, alpha), quad);
+    _sprite_batch_append(s->atlas, quad, 4);
 }
 
-float tkmt_randf(float min, float max)
+/* === Text functions === */
+void tk_draw_text(const char *text, int x, int y, int scale, char *color)
 {
-    return ((max - min) * ((float)rand() / RAND_MAX)) + min;
+    SDL_Color text_color = _hex_to_color(color, 255);
+    text_cache_entry_t *entry;
+    size_t length = strlen(text);
+    
+    if (length >= TEXT_CACHE_MAX_LENGTH){
+        /* Too long to cache, lay it out every time */
+        SDL_Vertex_darray_clear(text_scratch);
+        _layout_text(text, x, y, scale, text_color, &text_scratch);
+        _sprite_batch_append(font.atlas, text_scratch, SDL_Vertex_darray_count(text_scratch));
+        return;
+    }
+    
+    entry = _text_cache_get(text, length, x, y, scale, text_color);
+    _sprite_batch_append(font.atlas, entry->vertices, SDL_Vertex_darray_count(entry->vertices));
 }
 
-/*=== Collition Related Functions ===*/
-char tkcol_point_vs_rect(int px, int py, int rx, int ry, int rw, int rh)
+int tk_get_text_width(const char *text, int scale)
 {
-    return (px >= rx && py >= ry && px <= rx + rw && py <= ry + rh);
+    int width = 0, line_width = 0;
+    
+    for (; *text; text++){
+        if (*text == '\n'){
+            line_width = 0;
+            continue;
+        }
+        line_width += FONT_ADVANCE * scale;
+        if (line_width > width) width = line_width;
+    }
+    
+    /* No spacing after the last glyph */
+    return (width > 0) ? width - (FONT_ADVANCE - FONT_GLYPH_WIDTH) * scale : 0;
 }
 
-char tkcol_rect_vs_rect(int x1, int y1, int w1, int h1, int x2, int y2, int w2, int h2)
+/* === Particle functions === */
+tk_emitter_t* tk_emitter_create(size_t capacity)
 {
-    return (x1 < x2 + w2 && x2 < x1 + w1 && y1 < y2 + h2 && y2 < y1 + h1);
+    return tk_emitter_create_at(capacity, __func__, 0);
 }
 
-/*=== Darray Functions ===*/
-#define DEFAULT_CAPACITY 1
-#define DEFAULT_RESIZE_FACTOR 2 /* Whenever darray is full, double the size */
-
-enum { /* Dynamic Array's header elements */
-    DARRAY_CAPACITY,
-    DARRAY_LENGTH,
-    DARRAY_ITEM_SIZE,
-    DARRAY_ELEMENT_COUNT,
-};
-
-void* tk_darray_create(size_t item_size)
+tk_emitter_t* tk_emitter_create_at(size_t capacity, const char *file, int line)
 {
-    /*
-Memory layout of darray:
-size_t capacity = number of items that can be held.
-size_t length = number of items that array currently has.
-size_t item_size = the size of each items in bytes.
-void * items
-*/
-    size_t header_size = DARRAY_ELEMENT_COUNT * sizeof(size_t);
-    size_t array_size = DEFAULT_CAPACITY * item_size;
-    size_t *new_array;
+    tk_emitter_t *emitter;
+    char *block;
     
-    new_array = malloc(header_size + array_size);
-    if (!new_array) exit(1);
-    memset(new_array, 0, header_size + array_size);
+    emitter = MEM_ALLOC_AT(sizeof(tk_emitter_t), file, line);
+    if (!emitter) exit(1);
+    memset(emitter, 0, sizeof(tk_emitter_t));
     
-    new_array[DARRAY_CAPACITY] = DEFAULT_CAPACITY;
-    new_array[DARRAY_LENGTH] = 0;
-    new_array[DARRAY_ITEM_SIZE] = item_size;
+    /* One block for all the pools, so that a single free releases them */
+    block = MEM_ALLOC_LIKE(capacity * (6 * sizeof(float) + sizeof(SDL_Color) + 4 * sizeof(SDL_Vertex) + 6 * sizeof(int)),
+                           emitter);
+    if (!block) exit(1);
     
-    /* returns the address where user can actually store data */
-    return (void*)(new_array + DARRAY_ELEMENT_COUNT);
+    emitter->vertices = (SDL_Vertex*)block;
+    block += capacity * 4 * sizeof(SDL_Vertex);
+    emitter->x = (float*)block;
+    emitter->y = emitter->x + capacity;
+    emitter->dx = emitter->y + capacity;
+    emitter->dy = emitter->dx + capacity;
+    emitter->life = emitter->dy + capacity;
+    emitter->inv_max_life = emitter->life + capacity;
+    block += capacity * 6 * sizeof(float);
+    emitter->indices = (int*)block;
+    block += capacity * 6 * sizeof(int);
+    emitter->color = (SDL_Color*)block;
+    
+    emitter->capacity = capacity;
+    emitter->min_life = emitter->max_life = 1.0f;
+    emitter->size = 4;
+    emitter->base_color = (SDL_Color){255, 255, 255, 255};
+    emitter->random_state = 2463534242u;
+    
+    /* The quads never change order, so the index buffer is built once */
+    _build_quad_indices(emitter->indices, 0, capacity);
+    
+    return emitter;
 }
 
-void tk_darray_destroy(void *darray)
+void tk_emitter_destroy(tk_emitter_t *emitter)
 {
-    /* Back to the adress at the very first of darray header(which was gave from malloc), and free it */
-    darray = (size_t*)darray - DARRAY_ELEMENT_COUNT;
-    free(darray);
+    /* vertices is the start of the pool block */
+    MEM_FREE(emitter->vertices);
+    MEM_FREE(emitter);
 }
 
-static size_t __get_header_element(void *darray, int element)
+void tk_emitter_set_position(tk_emitter_t *emitter, float x, float y)
 {
-    /* Back to the adress at the very first of darray header */
-    size_t *arr = (size_t*)darray - DARRAY_ELEMENT_COUNT;
-    
-    return arr[element];
+    emitter->emit_x = x;
+    emitter->emit_y = y;
 }
 
-static void __set_header_element(void *darray, int element, size_t value)
+void tk_emitter_set_rate(tk_emitter_t *emitter, float rate)
 {
-    /* Back to the adress at the very first of darray header */
-    size_t *arr = (size_t*)darray - DARRAY_ELEMENT_COUNT;
-    
-    arr[element] = value;
+    emitter->rate = rate;
+    if (rate <= 0.0f) emitter->rate_accumulator = 0.0f;
 }
 
-static void* __darray_resize(void *darray, int resize_factor)
+void tk_emitter_set_motion(tk_emitter_t *emitter, float min_dx, float max_dx, float min_dy, float max_dy,
+                           float min_life, float max_life)
 {
-    size_t capacity =__get_header_element(darray, DARRAY_CAPACITY);
-    size_t item_size = __get_header_element(darray, DARRAY_ITEM_SIZE);
-    size_t length = __get_header_element(darray, DARRAY_LENGTH);
-    size_t header_size = DARRAY_ELEMENT_COUNT * sizeof(size_t);
-    size_t new_array_size = header_size + capacity * item_size * resize_factor;
-    size_t *resized_array;
-    size_t *tmp;
-    /* A address of the head of the header*/
-    size_t *addr = (size_t*)darray - DARRAY_ELEMENT_COUNT;
-    
-    resized_array = malloc(new_array_size);
-    if (!resized_array) exit(1);
+    emitter->min_dx = min_dx;
+    emitter->max_dx = max_dx;
+    emitter->min_dy = min_dy;
+    emitter->max_dy = max_dy;
+    emitter->min_life = min_life;
+    emitter->max_life = max_life;
+}
+
+void tk_emitter_set_style(tk_emitter_t *emitter, int size, int alpha, char *color)
+{
+    emitter->size = size;
+    emitter->base_color = _hex_to_color(color, alpha);
+}
+
+void tk_emitter_burst(tk_emitter_t *emitter, int count)
+{
+    size_t i;
+    float life;
     
-    memset(resized_array, 0, new_array_size);
-    memcpy(resized_array, addr, header_size + (length * item_size));
+    for (; count > 0 && emitter->count < emitter->capacity; count--){
+        i = emitter->count++;
+        life = _emitter_randf(emitter, emitter->min_life, emitter->max_life);
+        emitter->x[i] = emitter->emit_x;
+        emitter->y[i] = emitter->emit_y;
+        emitter->dx[i] = _emitter_randf(emitter, emitter->min_dx, emitter->max_dx);
+        emitter->dy[i] = _emitter_randf(emitter, emitter->min_dy, emitter->max_dy);
+        emitter->life[i] = life;
+        emitter->inv_max_life[i] = (life > 0.0f) ? 1.0f / life : 0.0f;
+        emitter->color[i] = emitter->base_color;
+    }
+}
+
+void tk_emitter_update(tk_emitter_t *emitter, double dt)
+{
+    const float fdt = (float)dt;
+    size_t i, count = emitter->count;
+    int spawn;
     
-    /* Update capacity header data */
-    tmp = resized_array + DARRAY_ELEMENT_COUNT;
-    __set_header_element(tmp, DARRAY_CAPACITY, capacity * resize_factor);
+    _emitter_integrate(emitter->x, emitter->y, emitter->dx, emitter->dy, emitter->life, count, fdt);
     
-    /* The address that  was given by malloc when created */
-    free(addr);
+    /* Remove dead particles by moving the last particle into their slot */
+    i = 0;
+    while (i < count){
+        if (emitter->life[i] > 0.0f){
+            i++;
+            continue;
+        }
+        count--;
+        emitter->x[i] = emitter->x[count];
+        emitter->y[i] = emitter->y[count];
+        emitter->dx[i] = emitter->dx[count];
+        emitter->dy[i] = emitter->dy[count];
+        emitter->life[i] = emitter->life[count];
+        emitter->inv_max_life[i] = emitter->inv_max_life[count];
+        emitter->color[i] = emitter->color[count];
+    }
+    emitter->count = count;
     
-    return (void*)(resized_array + DARRAY_ELEMENT_COUNT);
+    /* Spawn by rate, carrying the fraction over so that low rates still emit at high frame rates */
+    emitter->rate_accumulator += emitter->rate * fdt;
+    spawn = (int)emitter->rate_accumulator;
+    emitter->rate_accumulator -= (float)spawn;
+    tk_emitter_burst(emitter, spawn);
 }
 
-void tk_darray_push(void **darray, const void *item)
+void tk_emitter_draw(tk_emitter_t *emitter)
 {
-    size_t item_size = __get_header_element(*darray, DARRAY_ITEM_SIZE);
-    size_t capacity = __get_header_element(*darray, DARRAY_CAPACITY);
-    size_t length = __get_header_element(*darray, DARRAY_LENGTH);
-    char *addr_to_add;
+    const float half = (float)emitter->size * 0.5f;
+    SDL_Vertex *vertex = emitter->vertices;
+    SDL_Color color;
+    size_t i;
     
-    /* Resize the darray if needed */
-    if (length >= capacity){
-        *darray = __darray_resize(*darray, DEFAULT_RESIZE_FACTOR);
-    }
+    if (emitter->count == 0) return;
     
-    /* Move the pointer to the end, casting char* (1 byte)*/
-    addr_to_add = (char*)*darray + (length * item_size);
-    memcpy((void*)addr_to_add, item, item_size);
+    for (i = 0; i < emitter->count; i++){
+        const float x = emitter->x[i], y = emitter->y[i];
+        color = emitter->color[i];
+        color.a = (Uint8)((float)color.a * emitter->life[i] * emitter->inv_max_life[i]);
+        
+        vertex[0] = (SDL_Vertex){ {x - half, y - half}, color, {0.0f, 0.0f} };
+        vertex[1] = (SDL_Vertex){ {x + half, y - half}, color, {0.0f, 0.0f} };
+        vertex[2] = (SDL_Vertex){ {x + half, y + half}, color, {0.0f, 0.0f} };
+        vertex[3] = (SDL_Vertex){ {x - half, y + half}, color, {0.0f, 0.0f} };
+        vertex += 4;
+    }
     
-    /* update length data in header */
-    __set_header_element(*darray, DARRAY_LENGTH, length + 1);
+    _flush_sprite_batch();
+    SDL_RenderGeometry(app.renderer, NULL, emitter->vertices, (int)(emitter->count * 4),
+                       emitter->indices, (int)(emitter->count * 6));
 }
 
-size_t tk_darray_count(void *darray)
+/* === Entity functions === */
+tk_world_t* tk_world_create(size_t capacity)
 {
-    return __get_header_element(darray, DARRAY_LENGTH);
+    return tk_world_create_at(capacity, __func__, 0);
 }
 
-void tk_darray_pop(void *darray)
+tk_world_t* tk_world_create_at(size_t capacity, const char *file, int line)
 {
-    size_t item_size = __get_header_element(darray, DARRAY_ITEM_SIZE);
-    size_t length = __get_header_element(darray, DARRAY_LENGTH);
-    /*Move the pointer to the end, casting char* (1byte) */
-    char *addr_to_delete = (char*)darray + ((length - 1) * item_size);
-    memset(addr_to_delete, 0, item_size);
+    tk_world_t *world;
+    char *block;
     
-    /* Update length data in header */
-    __set_header_element(darray, DARRAY_LENGTH, length - 1);
-}
-
-void tk_darray_insert_at(void** darray, void* item, size_t index){
-    size_t item_size = __get_header_element(*darray, DARRAY_ITEM_SIZE);
-    size_t length = __get_header_element(*darray, DARRAY_LENGTH);
-    size_t capacity = __get_header_element(*darray, DARRAY_CAPACITY);
+    if (capacity > ENTITY_INDEX_MASK + 1) capacity = ENTITY_INDEX_MASK + 1;
     
-    /* If the darray already at the full capacity, resize */
-    if (index >= capacity){
-        int resize_factor = 0; 
-        size_t new_capacity = capacity;
-        do{
-            resize_factor += 2;
-            new_capacity =  new_capacity * resize_factor;
-        }while (index >= new_capacity);
-        
-        *darray = __darray_resize(*darray, resize_factor);
-        capacity = __get_header_element(*darray, DARRAY_CAPACITY);
-    }
+    world = MEM_ALLOC_AT(sizeof(tk_world_t), file, line);
+    if (!world) exit(1);
+    memset(world, 0, sizeof(tk_world_t));
     
-    char *addr = (char*)*darray;
-    /* If index is not the last item in the array, copy the memory onwards */
-    if (index != length - 1){
-        memcpy((void*)(addr + ((index + 1) * item_size)),
-               (void*)(addr + index * item_size),
-               item_size * (capacity - index - 1));
-    }
+    /* One block for all the arrays, largest alignment first */
+    block = MEM_ALLOC_LIKE(capacity * (4 * sizeof(SDL_Vertex) + 6 * sizeof(float) + 3 * sizeof(Uint32) + 6 * sizeof(int) +
+                                       sizeof(SDL_Color) + sizeof(Uint16) + sizeof(Uint8)), world);
+    if (!block) exit(1);
     
-    memcpy((void*)(addr + index * item_size), item, item_size);
+    world->vertices = (SDL_Vertex*)block;
+    block += capacity * 4 * sizeof(SDL_Vertex);
+    world->x = (float*)block;
+    world->y = world->x + capacity;
+    world->dx = world->y + capacity;
+    world->dy = world->dx + capacity;
+    world->w = world->dy + capacity;
+    world->h = world->w + capacity;
+    block += capacity * 6 * sizeof(float);
+    world->owner = (Uint32*)block;
+    world->slots = world->owner + capacity;
+    world->free_indices = world->slots + capacity;
+    block += capacity * 3 * sizeof(Uint32);
+    world->indices = (int*)block;
+    block += capacity * 6 * sizeof(int);
+    world->color = (SDL_Color*)block;
+    block += capacity * sizeof(SDL_Color);
+    world->generations = (Uint16*)block;
+    block += capacity * sizeof(Uint16);
+    world->flags = (Uint8*)block;
     
-    /* Update header data*/
-    __set_header_element(*darray, DARRAY_LENGTH, (index + 1 > length + 1) ? index + 1 : length + 1);
+    world->capacity = capacity;
+    _build_quad_indices(world->indices, 0, capacity);
+    
+    return world;
 }
 
-void tk_darray_erase_at(void* darray, size_t index)
+void tk_world_destroy(tk_world_t *world)
 {
-    size_t item_size = __get_header_element(darray, DARRAY_ITEM_SIZE);
-    size_t capacity = __get_header_element(darray, DARRAY_CAPACITY);
-    size_t length = __get_header_element(darray, DARRAY_LENGTH);
-    char *addr = (char*)darray;
-    /*If index is not the last item in the array, copy the memory onwards */
-    
-    if (index != length -1){
-        memcpy((void*)(addr + (index * item_size)), 
-               (void*)(addr + ((index + 1) * item_size)),
-               item_size * (capacity - index));
-    }
-    /* Erase the last item */
-    tk_darray_pop(darray);
-    /* Update the header */
-    __set_header_element(darray, DARRAY_LENGTH, length - 1);
+    /* vertices is the start of the array block */
+    MEM_FREE(world->vertices);
+    MEM_FREE(world);
 }
 
-/*=== Linked List functions ===*/
-tk_node_t* tk_list_create(void* data){
-    tk_node_t *node; 
+tk_entity_t tk_entity_create(tk_world_t *world, float x, float y, float w, float h, char *color, Uint8 flags)
+{
+    Uint32 index;
+    size_t slot;
     
-    node = malloc(sizeof(tk_node_t));
-    if(!node){
-        return NULL;
+    if (world->count >= world->capacity) return TK_ENTITY_NONE;
+    
+    /* Reuse the index of a destroyed entity, its generation was bumped so old handles stay stale */
+    if (world->free_count > 0){
+        index = world->free_indices[--world->free_count];
+    }
+    else{
+        index = (Uint32)world->index_count++;
+        world->generations[index] = 1;
     }
     
-    node->data = data;
-    node->next = NULL;
+    slot = world->count++;
+    world->x[slot] = x;
+    world->y[slot] = y;
+    world->dx[slot] = 0.0f;
+    world->dy[slot] = 0.0f;
+    world->w[slot] = w;
+    world->h[slot] = h;
+    world->color[slot] = _hex_to_color(color, 255);
+    world->flags[slot] = flags;
+    world->owner[slot] = index;
+    world->slots[index] = (Uint32)slot;
     
-    return node;
+    return _entity_handle(world, index);
 }
 
-void tk_list_destroy(tk_node_t **list, int flag)
+void tk_entity_destroy(tk_world_t *world, tk_entity_t entity)
 {
-    tk_node_t *current, *tmp;
+    Uint32 index = entity & ENTITY_INDEX_MASK;
+    size_t slot, last;
     
-    current = *list;
-    while(current->next != NULL){
-        tmp = current->next;
-        if (flag) free(current->data);
-        free(current);
-        current = tmp;
-    }
+    if (!tk_entity_alive(world, entity)) return;
     
-    *list = NULL;
+    /* Keep the arrays packed by moving the last entity into the hole */
+    slot = world->slots[index];
+    last = --world->count;
+    world->x[slot] = world->x[last];
+    world->y[slot] = world->y[last];
+    world->dx[slot] = world->dx[last];
+    world->dy[slot] = world->dy[last];
+    world->w[slot] = world->w[last];
+    world->h[slot] = world->h[last];
+    world->color[slot] = world->color[last];
+    world->flags[slot] = world->flags[last];
+    world->owner[slot] = world->owner[last];
+    world->slots[world->owner[slot]] = (Uint32)slot;
+    
+    /* Generation 0 is skipped, so that no handle is ever TK_ENTITY_NONE */
+    world->generations[index] = (Uint16)((world->generations[index] % ENTITY_GENERATION_MASK) + 1);
+    world->free_indices[world->free_count++] = index;
 }
 
-int tk_list_push_front(tk_node_t **list, void *data)
+bool tk_entity_alive(tk_world_t *world, tk_entity_t entity)
 {
-    tk_node_t *new_node; 
-    
-    new_node = malloc(sizeof(tk_node_t));
-    if(!new_node){
-        return -1;
-    }
+    Uint32 index = entity & ENTITY_INDEX_MASK;
     
-    new_node->data = data;
+    return index < world->index_count &&
+        world->generations[index] == (entity >> ENTITY_INDEX_BITS) &&
+        world->slots[index] < world->count && world->owner[world->slots[index]] == index;
+}
+
+size_t tk_entity_slot(tk_world_t *world, tk_entity_t entity)
+{
+    if (!tk_entity_alive(world, entity)) return TK_ENTITY_NO_SLOT;
+    
+    return world->slots[entity & ENTITY_INDEX_MASK];
+}
+
+void tk_world_move(tk_world_t *world, double dt)
+{
+    _integrate_axis(world->x, world->dx, world->count, (float)dt);
+    _integrate_axis(world->y, world->dy, world->count, (float)dt);
+}
+
+void tk_world_clamp(tk_world_t *world, float min_x, float min_y, float max_x, float max_y)
+{
+    size_t i;
+    
+    for (i = 0; i < world->count; i++){
+        if (world->flags[i] & TK_ENTITY_CLAMP){
+            world->x[i] = tkmt_clampf(world->x[i], min_x, max_x - world->w[i]);
+            world->y[i] = tkmt_clampf(world->y[i], min_y, max_y - world->h[i]);
+        }
+    }
+}
+
+size_t tk_world_collide(tk_world_t *world, tk_entity_t entity, tk_entity_t *hits, size_t max_hits)
+{
+    size_t self = tk_entity_slot(world, entity);
+    size_t i, hit_count = 0;
+    int x, y, w, h;
+    
+    if (self == TK_ENTITY_NO_SLOT) return 0;
+    
+    x = (int)world->x[self];
+    y = (int)world->y[self];
+    w = (int)world->w[self];
+    h = (int)world->h[self];
+    
+    for (i = 0; i < world->count && hit_count < max_hits; i++){
+        if (i != self && (world->flags[i] & TK_ENTITY_SOLID) &&
+            tkcol_rect_vs_rect((int)world->x[i], (int)world->y[i], (int)world->w[i], (int)world->h[i], x, y, w, h)){
+            hits[hit_count++] = _entity_handle(world, world->owner[i]);
+        }
+    }
+    
+    return hit_count;
+}
+
+void tk_world_draw(tk_world_t *world)
+{
+    SDL_Vertex *vertex = world->vertices;
+    size_t i;
+    
+    if (world->count == 0) return;
+    
+    for (i = 0; i < world->count; i++){
+        const float x0 = world->x[i], y0 = world->y[i];
+        const float x1 = x0 + world->w[i], y1 = y0 + world->h[i];
+        
+        vertex[0] = (SDL_Vertex){ {x0, y0}, world->color[i], {0.0f, 0.0f} };
+        vertex[1] = (SDL_Vertex){ {x1, y0}, world->color[i], {0.0f, 0.0f} };
+        vertex[2] = (SDL_Vertex){ {x1, y1}, world->color[i], {0.0f, 0.0f} };
+        vertex[3] = (SDL_Vertex){ {x0, y1}, world->color[i], {0.0f, 0.0f} };
+        vertex += 4;
+    }
+    
+    _flush_sprite_batch();
+    SDL_RenderGeometry(app.renderer, NULL, world->vertices, (int)(world->count * 4),
+                       world->indices, (int)(world->count * 6));
+}
+
+/* === Snapshot functions === */
+void tk_snapshot_begin(tk_snapshot_t *snapshot, void *data, size_t size)
+{
+    snapshot->data = data;
+    snapshot->size = size;
+    snapshot->cursor = 0;
+}
+
+int tk_snapshot_write(tk_snapshot_t *snapshot, const void *value, size_t size)
+{
+    if (snapshot->cursor + size > snapshot->size) return -1;
+    
+    memcpy(snapshot->data + snapshot->cursor, value, size);
+    snapshot->cursor += size;
+    
+    return 0;
+}
+
+int tk_snapshot_read(tk_snapshot_t *snapshot, void *value, size_t size)
+{
+    if (snapshot->cursor + size > snapshot->size) return -1;
+    
+    memcpy(value, snapshot->data + snapshot->cursor, size);
+    snapshot->cursor += size;
+    
+    return 0;
+}
+
+tk_rewind_t* tk_rewind_create(size_t frame_size, size_t budget, int keyframe_interval)
+{
+    return tk_rewind_create_at(frame_size, budget, keyframe_interval, __func__, 0);
+}
+
+tk_rewind_t* tk_rewind_create_at(size_t frame_size, size_t budget, int keyframe_interval, const char *file, int line)
+{
+    tk_rewind_t *rewind;
+    size_t record_capacity = budget / REWIND_BYTES_PER_RECORD;
+    /* latest + worst case encoded frame, see _rewind_encode_delta() */
+    size_t scratch_size = frame_size + (frame_size * 2 + 2);
+    size_t fixed_size = sizeof(tk_rewind_t) + record_capacity * sizeof(rewind_record_t) + scratch_size;
+    
+    /* Two frames at least, otherwise there is nothing to rewind to */
+    if (record_capacity < 2 || fixed_size + frame_size * 2 > budget) return NULL;
+    
+    rewind = MEM_ALLOC_AT(budget, file, line);
+    if (!rewind) exit(1);
+    memset(rewind, 0, sizeof(tk_rewind_t));
+    
+    /* Everything lives in the single budget block */
+    rewind->records = (rewind_record_t*)(rewind + 1);
+    rewind->latest = (unsigned char*)(rewind->records + record_capacity);
+    rewind->encoded = rewind->latest + frame_size;
+    rewind->data = rewind->encoded + (frame_size * 2 + 2);
+    
+    rewind->frame_size = frame_size;
+    rewind->keyframe_interval = (keyframe_interval > 0) ? keyframe_interval : 1;
+    rewind->record_capacity = record_capacity;
+    rewind->data_capacity = budget - fixed_size;
+    
+    return rewind;
+}
+
+void tk_rewind_destroy(tk_rewind_t *rewind)
+{
+    MEM_FREE(rewind);
+}
+
+void tk_rewind_push(tk_rewind_t *rewind, const void *frame)
+{
+    rewind_record_t *record;
+    bool keyframe = (rewind->count == 0 || rewind->frames_since_keyframe >= rewind->keyframe_interval);
+    size_t size = 0, offset;
+    
+    if (!keyframe){
+        size = _rewind_encode_delta(rewind, frame);
+        /* A delta bigger than the frame itself is not worth it */
+        if (size >= rewind->frame_size) keyframe = true;
+    }
+    
+    for (;;){
+        if (keyframe) size = rewind->frame_size;
+        
+        if (rewind->count < rewind->record_capacity && _rewind_find_space(rewind, size, &offset)) break;
+        
+        /* Drop the oldest keyframe with its deltas. If nothing is left, the delta has no base anymore */
+        _rewind_drop_oldest(rewind);
+        if (rewind->count == 0) keyframe = true;
+    }
+    
+    memcpy(rewind->data + offset, keyframe ? (const unsigned char*)frame : rewind->encoded, size);
+    
+    record = &rewind->records[(rewind->first + rewind->count) % rewind->record_capacity];
+    record->offset = offset;
+    record->size = size;
+    record->keyframe = keyframe;
+    rewind->count++;
+    rewind->head = offset + size;
+    rewind->frames_since_keyframe = keyframe ? 1 : rewind->frames_since_keyframe + 1;
+    
+    memcpy(rewind->latest, frame, rewind->frame_size);
+}
+
+size_t tk_rewind_count(tk_rewind_t *rewind)
+{
+    return rewind->count;
+}
+
+int tk_rewind_seek(tk_rewind_t *rewind, size_t frames_back, void *frame)
+{
+    size_t target, index;
+    rewind_record_t *record;
+    
+    if (frames_back >= rewind->count) return -1;
+    
+    if (frames_back == 0){
+        memcpy(frame, rewind->latest, rewind->frame_size);
+        return 0;
+    }
+    
+    /* Find the keyframe at or before the target, then apply the deltas up to the target */
+    target = rewind->count - 1 - frames_back;
+    index = target;
+    while (!rewind->records[(rewind->first + index) % rewind->record_capacity].keyframe){
+        index--;
+    }
+    
+    record = &rewind->records[(rewind->first + index) % rewind->record_capacity];
+    memcpy(frame, rewind->data + record->offset, rewind->frame_size);
+    
+    for (index++; index <= target; index++){
+        record = &rewind->records[(rewind->first + index) % rewind->record_capacity];
+        _rewind_apply_delta(frame, rewind->data + record->offset, record->size);
+    }
+    
+    return 0;
+}
+
+int tk_rewind_step_back(tk_rewind_t *rewind, size_t frames, void *frame)
+{
+    size_t index;
+    rewind_record_t *last;
+    
+    if (rewind->count == 0) return -1;
+    if (frames >= rewind->count) frames = rewind->count - 1;
+    
+    tk_rewind_seek(rewind, frames, frame);
+    
+    rewind->count -= frames;
+    last = &rewind->records[(rewind->first + rewind->count - 1) % rewind->record_capacity];
+    rewind->head = last->offset + last->size;
+    memcpy(rewind->latest, frame, rewind->frame_size);
+    
+    /* Count the frames since the last keyframe again, so the keyframe interval still holds */
+    rewind->frames_since_keyframe = 0;
+    index = rewind->count;
+    do{
+        index--;
+        rewind->frames_since_keyframe++;
+    }while (!rewind->records[(rewind->first + index) % rewind->record_capacity].keyframe);
+    
+    return 0;
+}
+
+/* === Frame memory functions === */
+void* tk_frame_alloc(size_t size)
+{
+    size_t aligned_size = (size + FRAME_ARENA_ALIGNMENT - 1) & ~(size_t)(FRAME_ARENA_ALIGNMENT - 1);
+    size_t offset;
+    
+    /* The offset keeps growing past the end on failure, so the high water mark tells how big the arena should be */
+    offset = (size_t)SDL_AtomicAdd(&frame_arena.offset, (int)aligned_size);
+    if (offset + aligned_size > frame_arena.size){
+        return NULL;
+    }
+    
+    return frame_arena.blocks[frame_arena.current] + offset;
+}
+
+size_t tk_get_frame_arena_used(void)
+{
+    size_t used = (size_t)SDL_AtomicGet(&frame_arena.offset);
+    
+    return (used > frame_arena.size) ? frame_arena.size : used;
+}
+
+size_t tk_get_frame_arena_high_water(void)
+{
+    size_t used = (size_t)SDL_AtomicGet(&frame_arena.offset);
+    
+    return (used > frame_arena.high_water) ? used : frame_arena.high_water;
+}
+
+/* === Math functions === */
+int tkmt_clamp(int value_to_clamp, int min, int max)
+{
+    if (value_to_clamp < min) 
+        return  min;
+    if (value_to_clamp > max)
+        return max;
+    
+    return value_to_clamp;
+}
+
+float tkmt_clampf(float value_to_clamp, float min, float max)
+{
+    if (value_to_clamp < min) 
+        return  min;
+    if (value_to_clamp > max)
+        return max;
+    
+    return value_to_clamp;
+}
+
+void tkmt_srand(void)
+{
+    srand((unsigned int)time(NULL));
+}
+
+int tkmt_rand(int min, int max){
+    /* In double, rand() * range and RAND_MAX + 1 overflow int */
+    return min + (int)((double)rand() * (max - min + 1) / ((double)RAND_MAX + 1.0));
+}
+
+float tkmt_randf(float min, float max)
+{
+    return ((max - min) * ((float)rand() / RAND_MAX)) + min;
+}
+
+/*=== Collition Related Functions ===*/
+char tkcol_point_vs_rect(int px, int py, int rx, int ry, int rw, int rh)
+{
+    return (px >= rx && py >= ry && px <= rx + rw && py <= ry + rh);
+}
+
+char tkcol_rect_vs_rect(int x1, int y1, int w1, int h1, int x2, int y2, int w2, int h2)
+{
+    return (x1 < x2 + w2 && x2 < x1 + w1 && y1 < y2 + h2 && y2 < y1 + h1);
+}
+
+char tkcol_predict_y(float x, float y, float dx, float dy, int h, float target_x, float *out_y)
+{
+    float t;
+    
+    if (dx == 0.0f) return 0;
+    
+    t = (target_x - x) / dx;
+    if (t < 0.0f) return 0;
+    
+    *out_y = _fold_y(y + dy * t, (float)(tk_get_window_height() - h));
+    
+    return 1;
+}
+
+void tkcol_predict_y_n(const float *x, const float *y, const float *dx, const float *dy, int h, float target_x,
+                       float *out_y, size_t count)
+{
+    const float range = (float)(tk_get_window_height() - h);
+    float t;
+    size_t i;
+    
+    for (i = 0; i < count; i++){
+        /* A ball without horizontal speed never arrives, as in tkcol_predict_y() */
+        t = (dx[i] != 0.0f) ? (target_x - x[i]) / dx[i] : -1.0f;
+        /* Not moving toward target_x */
+        out_y[i] = (t >= 0.0f) ? _fold_y(y[i] + dy[i] * t, range) : -1.0f;
+    }
+}
+
+/*=== Memory functions ===*/
+void tk_set_allocator(const tk_allocator_t *custom_allocator)
+{
+    if (custom_allocator){
+        allocator = *custom_allocator;
+    }
+    else{
+        memset(&allocator, 0, sizeof(allocator));
+    }
+}
+
+void tk_get_alloc_stats(tk_alloc_stats_t *stats)
+{
+#ifdef TK_TRACK_ALLOCATIONS
+    SDL_AtomicLock(&alloc_lock);
+    *stats = alloc_stats;
+    SDL_AtomicUnlock(&alloc_lock);
+#else
+    memset(stats, 0, sizeof(tk_alloc_stats_t));
+#endif
+}
+
+void tk_print_alloc_report(void)
+{
+#ifdef TK_TRACK_ALLOCATIONS
+    size_t i;
+    
+    SDL_AtomicLock(&alloc_lock);
+    printf("Memory: %zu allocations (%zu bytes) live, peak %zu bytes, %zu allocations in total\n",
+           alloc_stats.live_count, alloc_stats.live_bytes, alloc_stats.peak_bytes, alloc_stats.total_count);
+    for (i = 0; i < alloc_site_count; i++){
+        const tk_alloc_stats_t *site = &alloc_sites[i].stats;
+        printf("  %s%s", (site->live_count > 0) ? "LEAK " : "", alloc_sites[i].name);
+        if (alloc_sites[i].line > 0) printf(":%d", alloc_sites[i].line);
+        printf(": %zu live (%zu bytes), peak %zu bytes, %zu in total\n",
+               site->live_count, site->live_bytes, site->peak_bytes, site->total_count);
+    }
+    SDL_AtomicUnlock(&alloc_lock);
+#else
+    printf("Memory: allocation tracking is disabled, build ticket.c with TK_TRACK_ALLOCATIONS defined\n");
+#endif
+}
+
+/*=== Darray Functions ===*/
+#define DEFAULT_CAPACITY 1
+#define DEFAULT_RESIZE_FACTOR 2 /* Whenever darray is full, double the size */
+
+void* tk_darray_create(size_t item_size)
+{
+    return tk_darray_create_at(item_size, __func__, 0);
+}
+
+void* tk_darray_create_at(size_t item_size, const char *file, int line)
+{
+    /*
+Memory layout of darray:
+size_t capacity = number of items that can be held.
+size_t length = number of items that array currently has.
+size_t item_size = the size of each items in bytes.
+void * items
+*/
+    size_t header_size = TK_DARRAY_HEADER_COUNT * sizeof(size_t);
+    size_t array_size = DEFAULT_CAPACITY * item_size;
+    size_t *new_array;
+    
+    new_array = MEM_ALLOC_AT(header_size + array_size, file, line);
+    if (!new_array) exit(1);
+    memset(new_array, 0, header_size + array_size);
+    
+    new_array[TK_DARRAY_CAPACITY] = DEFAULT_CAPACITY;
+    new_array[TK_DARRAY_LENGTH] = 0;
+    new_array[TK_DARRAY_ITEM_SIZE] = item_size;
+    
+    /* returns the address where user can actually store data */
+    return (void*)(new_array + TK_DARRAY_HEADER_COUNT);
+}
+
+void tk_darray_destroy(void *darray)
+{
+    /* Back to the adress at the very first of darray header(which was gave from MEM_ALLOC), and free it */
+    darray = (size_t*)darray - TK_DARRAY_HEADER_COUNT;
+    MEM_FREE(darray);
+}
+
+static size_t __get_header_element(void *darray, int element)
+{
+    /* Back to the adress at the very first of darray header */
+    size_t *arr = (size_t*)darray - TK_DARRAY_HEADER_COUNT;
+    
+    return arr[element];
+}
+
+static void __set_header_element(void *darray, int element, size_t value)
+{
+    /* Back to the adress at the very first of darray header */
+    size_t *arr = (size_t*)darray - TK_DARRAY_HEADER_COUNT;
+    
+    arr[element] = value;
+}
+
+static void* __darray_resize(void *darray, int resize_factor)
+{
+    size_t capacity =__get_header_element(darray, TK_DARRAY_CAPACITY);
+    size_t item_size = __get_header_element(darray, TK_DARRAY_ITEM_SIZE);
+    size_t length = __get_header_element(darray, TK_DARRAY_LENGTH);
+    size_t header_size = TK_DARRAY_HEADER_COUNT * sizeof(size_t);
+    size_t new_array_size = header_size + capacity * item_size * resize_factor;
+    size_t *resized_array;
+    size_t *tmp;
+    /* A address of the head of the header*/
+    size_t *addr = (size_t*)darray - TK_DARRAY_HEADER_COUNT;
+    
+    /* Charged to the site that created the darray */
+    resized_array = MEM_ALLOC_LIKE(new_array_size, addr);
+    if (!resized_array) exit(1);
+    
+    memset(resized_array, 0, new_array_size);
+    memcpy(resized_array, addr, header_size + (length * item_size));
+    
+    /* Update capacity header data */
+    tmp = resized_array + TK_DARRAY_HEADER_COUNT;
+    __set_header_element(tmp, TK_DARRAY_CAPACITY, capacity * resize_factor);
+    
+    /* The address that  was given by MEM_ALLOC when created */
+    MEM_FREE(addr);
+    
+    return (void*)(resized_array + TK_DARRAY_HEADER_COUNT);
+}
+
+void tk_darray_push(void **darray, const void *item)
+{
+    size_t item_size = __get_header_element(*darray, TK_DARRAY_ITEM_SIZE);
+    size_t capacity = __get_header_element(*darray, TK_DARRAY_CAPACITY);
+    size_t length = __get_header_element(*darray, TK_DARRAY_LENGTH);
+    char *addr_to_add;
+    
+    /* Resize the darray if needed */
+    if (length >= capacity){
+        *darray = __darray_resize(*darray, DEFAULT_RESIZE_FACTOR);
+    }
+    
+    /* Move the pointer to the end, casting char* (1 byte)*/
+    addr_to_add = (char*)*darray + (length * item_size);
+    memcpy((void*)addr_to_add, item, item_size);
+    
+    /* update length data in header */
+    __set_header_element(*darray, TK_DARRAY_LENGTH, length + 1);
+}
+
+void tk_darray_reserve(void **darray, size_t capacity)
+{
+    size_t current_capacity = __get_header_element(*darray, TK_DARRAY_CAPACITY);
+    size_t new_capacity = current_capacity;
+    
+    if (capacity <= current_capacity) return;
+    
+    while (new_capacity < capacity){
+        new_capacity *= DEFAULT_RESIZE_FACTOR;
+    }
+    
+    *darray = __darray_resize(*darray, (int)(new_capacity / current_capacity));
+}
+
+size_t tk_darray_count(void *darray)
+{
+    return __get_header_element(darray, TK_DARRAY_LENGTH);
+}
+
+void tk_darray_pop(void *darray)
+{
+    size_t item_size = __get_header_element(darray, TK_DARRAY_ITEM_SIZE);
+    size_t length = __get_header_element(darray, TK_DARRAY_LENGTH);
+    /*Move the pointer to the end, casting char* (1byte) */
+    char *addr_to_delete = (char*)darray + ((length - 1) * item_size);
+    memset(addr_to_delete, 0, item_size);
+    
+    /* Update length data in header */
+    __set_header_element(darray, TK_DARRAY_LENGTH, length - 1);
+}
+
+void tk_darray_insert_at(void** darray, void* item, size_t index){
+    size_t item_size = __get_header_element(*darray, TK_DARRAY_ITEM_SIZE);
+    size_t length = __get_header_element(*darray, TK_DARRAY_LENGTH);
+    size_t capacity = __get_header_element(*darray, TK_DARRAY_CAPACITY);
+    
+    /* If the darray already at the full capacity, resize */
+    if (index >= capacity){
+        int resize_factor = 0; 
+        size_t new_capacity = capacity;
+        do{
+            resize_factor += 2;
+            new_capacity =  new_capacity * resize_factor;
+        }while (index >= new_capacity);
+        
+        *darray = __darray_resize(*darray, resize_factor);
+        capacity = __get_header_element(*darray, TK_DARRAY_CAPACITY);
+    }
+    
+    char *addr = (char*)*darray;
+    /* If index is not the last item in the array, copy the memory onwards */
+    if (index != length - 1){
+        memcpy((void*)(addr + ((index + 1) * item_size)),
+               (void*)(addr + index * item_size),
+               item_size * (capacity - index - 1));
+    }
+    
+    memcpy((void*)(addr + index * item_size), item, item_size);
+    
+    /* Update header data*/
+    __set_header_element(*darray, TK_DARRAY_LENGTH, (index + 1 > length + 1) ? index + 1 : length + 1);
+}
+
+void tk_darray_erase_at(void* darray, size_t index)
+{
+    size_t item_size = __get_header_element(darray, TK_DARRAY_ITEM_SIZE);
+    size_t capacity = __get_header_element(darray, TK_DARRAY_CAPACITY);
+    size_t length = __get_header_element(darray, TK_DARRAY_LENGTH);
+    char *addr = (char*)darray;
+    /*If index is not the last item in the array, copy the memory onwards */
+    
+    if (index != length -1){
+        memcpy((void*)(addr + (index * item_size)), 
+               (void*)(addr + ((index + 1) * item_size)),
+               item_size * (capacity - index));
+    }
+    /* Erase the last item */
+    tk_darray_pop(darray);
+    /* Update the header */
+    __set_header_element(darray, TK_DARRAY_LENGTH, length - 1);
+}
+
+/*=== Linked List functions ===*/
+tk_node_t* tk_list_create(void* data){
+    return tk_list_create_at(data, __func__, 0);
+}
+
+tk_node_t* tk_list_create_at(void *data, const char *file, int line)
+{
+    tk_node_t *node; 
+    
+    node = MEM_ALLOC_AT(sizeof(tk_node_t), file, line);
+    if(!node){
+        return NULL;
+    }
+    
+    node->data = data;
+    node->next = NULL;
+    
+    return node;
+}
+
+void tk_list_destroy(tk_node_t **list, int flag)
+{
+    tk_node_t *current, *tmp;
+    
+    current = *list;
+    while(current != NULL){
+        tmp = current->next;
+        if (flag) free(current->data);
+        MEM_FREE(current);
+        current = tmp;
+    }
+    
+    *list = NULL;
+}
+
+int tk_list_push_front(tk_node_t **list, void *data)
+{
+    tk_node_t *new_node; 
+    
+    /* Nodes are charged to the site that created the list */
+    new_node = MEM_ALLOC_LIKE(sizeof(tk_node_t), *list);
+    if(!new_node){
+        return -1;
+    }
+    
+    new_node->data = data;
     new_node->next = *list;
     *list = new_node;
     
-    return 0;
+    return 0;
+}
+
+int tk_list_pop_front(tk_node_t **list, int flag)
+{
+    tk_node_t *tmp;
+    
+    if ((*list)->next == NULL) return 1;
+    tmp = *list;
+    
+    *list = tmp->next;
+    if (flag) free(tmp->data);
+    MEM_FREE(tmp);
+    
+    return 0;
+}
+
+int tk_list_push_back(tk_node_t *list, void* data)
+{
+    tk_node_t *new_node, *back_node;
+    
+    new_node = MEM_ALLOC_LIKE(sizeof(tk_node_t), list);
+    if (!new_node){
+        return -1;
+    }
+    
+    new_node->data = data;
+    new_node->next = NULL;
+    
+    back_node = tk_list_get_back(list); 
+    back_node->next = new_node;
+    
+    return 0;
+}
+
+int tk_list_pop_back(tk_node_t *list, int flag)
+{
+    tk_node_t *current;
+    
+    if (list->next == NULL) return 1;
+    
+    current = list;
+    while (current->next->next != NULL){
+        current = current->next;
+    }
+    
+    if (flag) free(current->next->data);
+    MEM_FREE(current->next);
+    current->next = NULL;
+    
+    return 0;
+}
+
+tk_node_t* tk_list_get_back(tk_node_t *list)
+{
+    tk_node_t *current;
+    
+    current = list;
+    while (current->next != NULL){
+        current = current->next;
+    }
+    
+    return current;
+}
+
+tk_node_t* tk_list_find(tk_node_t *list, void *data)
+{
+    tk_node_t *current;
+    
+    current = list;
+    while (current != NULL && current->data != data){
+        current = current->next;
+    }
+    
+    /* If current is null, it means the function could not find the data */
+    return current;
+}
+
+int tk_list_insert_after(tk_node_t *list, void* data_to_insert, void *data_to_find)
+{
+    tk_node_t *current, *node_to_insert;
+    
+    current = tk_list_find(list, data_to_find);
+    if (!current){
+        return -1; /* return -1 on fail to find the node*/
+    }
+    
+    node_to_insert = MEM_ALLOC_LIKE(sizeof(tk_node_t), list);
+    if (!node_to_insert){
+        return -1;
+    }
+    
+    node_to_insert->data = data_to_insert;
+    node_to_insert->next = current->next;
+    current->next = node_to_insert;
+    
+    return 0;
+}
+
+/*=== Hash map functions ===*/
+/*
+Open addressing with linear probing and Robin Hood ordering: an item moving in takes the slot of an
+item that is closer to its home slot. Probe lengths stay short and even, and a lookup can stop as soon
+as it passes items closer to home than the key would be. Erasing shifts the following items back
+instead of leaving tombstones.
+*/
+tk_hashmap_t* tk_hashmap_create(size_t key_size, size_t item_size)
+{
+    return tk_hashmap_create_at(key_size, item_size, __func__, 0);
+}
+
+tk_hashmap_t* tk_hashmap_create_at(size_t key_size, size_t item_size, const char *file, int line)
+{
+    tk_hashmap_t *map;
+    
+    map = MEM_ALLOC_AT(sizeof(tk_hashmap_t), file, line);
+    if (!map) exit(1);
+    memset(map, 0, sizeof(tk_hashmap_t));
+    
+    map->key_size = key_size;
+    map->item_size = item_size;
+    map->carry = MEM_ALLOC_LIKE(2 * (key_size + item_size), map);
+    if (!map->carry) exit(1);
+    
+    _hashmap_rehash(map, HASHMAP_MIN_CAPACITY);
+    
+    return map;
+}
+
+void tk_hashmap_destroy(tk_hashmap_t *map)
+{
+    /* hashes is the start of the slot block */
+    MEM_FREE(map->hashes);
+    MEM_FREE(map->carry);
+    MEM_FREE(map);
+}
+
+void* tk_hashmap_insert(tk_hashmap_t *map, const void *key, const void *item)
+{
+    Uint32 hash = _hashmap_hash(map, key);
+    size_t slot = _hashmap_find_slot(map, key, hash);
+    
+    if (slot == SIZE_MAX){
+        if ((map->count + 1) * HASHMAP_MAX_LOAD_DEN > map->capacity * HASHMAP_MAX_LOAD_NUM){
+            _hashmap_rehash(map, map->capacity * 2);
+        }
+        slot = _hashmap_place(map, key, item, hash);
+        map->count++;
+    }
+    else{
+        memcpy(map->items + slot * map->item_size, item, map->item_size);
+    }
+    
+    return map->items + slot * map->item_size;
+}
+
+void* tk_hashmap_find(tk_hashmap_t *map, const void *key)
+{
+    size_t slot = _hashmap_find_slot(map, key, _hashmap_hash(map, key));
+    
+    return (slot == SIZE_MAX) ? NULL : map->items + slot * map->item_size;
+}
+
+int tk_hashmap_erase(tk_hashmap_t *map, const void *key)
+{
+    const size_t mask = map->capacity - 1;
+    size_t slot = _hashmap_find_slot(map, key, _hashmap_hash(map, key));
+    size_t next;
+    
+    if (slot == SIZE_MAX) return -1;
+    
+    /* Shift the following items back by one, until an empty slot or an item already in its home slot */
+    next = (slot + 1) & mask;
+    while (map->hashes[next] != 0 && (map->hashes[next] & mask) != next){
+        map->hashes[slot] = map->hashes[next];
+        memcpy(map->keys + slot * map->key_size, map->keys + next * map->key_size, map->key_size);
+        memcpy(map->items + slot * map->item_size, map->items + next * map->item_size, map->item_size);
+        slot = next;
+        next = (next + 1) & mask;
+    }
+    map->hashes[slot] = 0;
+    map->count--;
+    
+    return 0;
+}
+
+void tk_hashmap_reserve(tk_hashmap_t *map, size_t count)
+{
+    size_t capacity = map->capacity;
+    
+    while (count * HASHMAP_MAX_LOAD_DEN > capacity * HASHMAP_MAX_LOAD_NUM){
+        capacity *= 2;
+    }
+    
+    if (capacity > map->capacity){
+        _hashmap_rehash(map, capacity);
+    }
+}
+
+size_t tk_hashmap_count(tk_hashmap_t *map)
+{
+    return map->count;
+}
+
+void tk_hashmap_clear(tk_hashmap_t *map)
+{
+    memset(map->hashes, 0, map->capacity * sizeof(Uint32));
+    map->count = 0;
+}
+
+bool tk_hashmap_next(tk_hashmap_t *map, size_t *iterator, void **key, void **item)
+{
+    size_t slot;
+    
+    for (slot = *iterator; slot < map->capacity; slot++){
+        if (map->hashes[slot] != 0){
+            if (key) *key = map->keys + slot * map->key_size;
+            if (item) *item = map->items + slot * map->item_size;
+            *iterator = slot + 1;
+            return true;
+        }
+    }
+    
+    *iterator = map->capacity;
+    return false;
+}
+
+/*=== Job system functions ===*/
+static int _job_current_queue(void)
+{
+    /* Threads that are not workers share the main thread's queue */
+    void *index = SDL_TLSGet(job_system.tls);
+    
+    return index ? (int)((intptr_t)index - 1) : 0;
+}
+
+static bool _job_queue_push(job_queue_t *queue, const job_t *job)
+{
+    bool pushed = false;
+    
+    SDL_AtomicLock(&queue->lock);
+    if (queue->tail - queue->head < JOB_QUEUE_CAPACITY){
+        queue->jobs[queue->tail & (JOB_QUEUE_CAPACITY - 1)] = *job;
+        queue->tail++;
+        pushed = true;
+    }
+    SDL_AtomicUnlock(&queue->lock);
+    
+    return pushed;
+}
+
+static bool _job_queue_pop(job_queue_t *queue, job_t *job)
+{
+    bool popped = false;
+    
+    /* The owner takes the newest job, its data is likely still in cache */
+    SDL_AtomicLock(&queue->lock);
+    if (queue->tail != queue->head){
+        queue->tail--;
+        *job = queue->jobs[queue->tail & (JOB_QUEUE_CAPACITY - 1)];
+        popped = true;
+    }
+    SDL_AtomicUnlock(&queue->lock);
+    
+    return popped;
+}
+
+static bool _job_queue_steal(job_queue_t *queue, job_t *job)
+{
+    bool stolen = false;
+    
+    /* Thieves take the oldest job, which is usually the biggest chunk of work left */
+    SDL_AtomicLock(&queue->lock);
+    if (queue->tail != queue->head){
+        *job = queue->jobs[queue->head & (JOB_QUEUE_CAPACITY - 1)];
+        queue->head++;
+        stolen = true;
+    }
+    SDL_AtomicUnlock(&queue->lock);
+    
+    return stolen;
+}
+
+static bool _job_get(int index, job_t *job)
+{
+    int i, queue_count = job_system.worker_count + 1;
+    
+    if (_job_queue_pop(&job_system.queues[index], job)) return true;
+    
+    for (i = 1; i < queue_count; i++){
+        if (_job_queue_steal(&job_system.queues[(index + i) % queue_count], job)) return true;
+    }
+    
+    return false;
+}
+
+static void _job_execute(const job_t *job);
+
+static void _job_submit(const job_t *job)
+{
+    if (!_job_queue_push(&job_system.queues[_job_current_queue()], job)){
+        /* The queue is full, run the job right away */
+        _job_execute(job);
+        return;
+    }
+    
+    /* Read with a full barrier, so that the push is visible before sleeping is checked, see _job_worker() */
+    if (SDL_AtomicAdd(&job_system.sleeping, 0) > 0){
+        SDL_SemPost(job_system.wake);
+    }
+}
+
+static void _job_release_deferred(void)
+{
+    size_t i, count;
+    job_t job;
+    bool found;
+    
+    /* Take the ready jobs out one at a time, submitting can run a job inline and end up here again */
+    do{
+        found = false;
+        SDL_AtomicLock(&job_system.deferred_lock);
+        count = job_t_darray_count(job_system.deferred);
+        for (i = 0; i < count; i++){
+            if (SDL_AtomicGet(&job_system.deferred[i].dependency->pending) == 0){
+                job = job_system.deferred[i];
+                job_system.deferred[i] = job_t_darray_pop(job_system.deferred);
+                SDL_AtomicAdd(&job_system.deferred_count, -1);
+                found = true;
+                break;
+            }
+        }
+        SDL_AtomicUnlock(&job_system.deferred_lock);
+        
+        if (found) _job_submit(&job);
+    }while (found);
+}
+
+static void _job_execute(const job_t *job)
+{
+    if (job->range_fn){
+        job->range_fn(job->begin, job->end, job->data);
+    }
+    else{
+        job->fn(job->data);
+    }
+    
+    /* SDL_AtomicAdd returns the previous value, 1 means this was the last job of the counter */
+    if (job->counter && SDL_AtomicAdd(&job->counter->pending, -1) == 1 &&
+        SDL_AtomicGet(&job_system.deferred_count) > 0){
+        _job_release_deferred();
+    }
+}
+
+static int _job_worker(void *data)
+{
+    int index = (int)(intptr_t)data;
+    int spin = 0;
+    job_t job;
+    
+    SDL_TLSSet(job_system.tls, (void*)(intptr_t)(index + 1), NULL);
+    
+    while (!SDL_AtomicGet(&job_system.quit)){
+        if (_job_get(index, &job)){
+            _job_execute(&job);
+            spin = 0;
+            continue;
+        }
+        
+        if (++spin < JOB_SPIN_COUNT) continue;
+        
+        /*
+        Nothing to do for a while, sleep until a job is pushed. Announce the sleep before the last try:
+        a job pushed after that try sees sleeping > 0 and posts, so the wake up can not be lost.
+        */
+        SDL_AtomicAdd(&job_system.sleeping, 1);
+        if (!_job_get(index, &job)){
+            SDL_SemWait(job_system.wake);
+            SDL_AtomicAdd(&job_system.sleeping, -1);
+        }
+        else{
+            SDL_AtomicAdd(&job_system.sleeping, -1);
+            _job_execute(&job);
+        }
+        spin = 0;
+    }
+    
+    return 0;
+}
+
+static int _atlas_add(int atlas, const void *pixels, int width, int height, int pitch)
+{
+    atlas_t *a;
+    sprite_t sprite;
+    SDL_Rect rect;
+    int shelf_x, shelf_y, shelf_height;
+    
+    if (atlas < 0 || atlas >= atlas_count) return -1;
+    a = &atlases[atlas];
+    
+    /* Start a new shelf when the sprite does not fit on the current one */
+    shelf_x = a->shelf_x;
+    shelf_y = a->shelf_y;
+    shelf_height = a->shelf_height;
+    if (shelf_x + width > a->width){
+        shelf_x = 0;
+        shelf_y += shelf_height + ATLAS_PADDING;
+        shelf_height = 0;
+    }
+    /* The atlas is only touched once the sprite fits, a smaller sprite can still go on the current shelf */
+    if (width > a->width || shelf_y + height > a->height){
+        printf("Atlas %d is full, could not add a %dx%d sprite\n", atlas, width, height);
+        return -1;
+    }
+    
+    rect = (SDL_Rect){shelf_x, shelf_y, width, height};
+    SDL_UpdateTexture(a->texture, &rect, pixels, pitch);
+    
+    a->shelf_x = shelf_x + width + ATLAS_PADDING;
+    a->shelf_y = shelf_y;
+    a->shelf_height = height > shelf_height ? height : shelf_height;
+    
+    sprite.atlas = atlas;
+    sprite.u0 = (float)rect.x / (float)a->width;
+    sprite.v0 = (float)rect.y / (float)a->height;
+    sprite.u1 = (float)(rect.x + rect.w) / (float)a->width;
+    sprite.v1 = (float)(rect.y + rect.h) / (float)a->height;
+    sprite_t_darray_push(&sprites, sprite);
+    
+    return (int)sprite_t_darray_count(sprites) - 1;
+}
+
+static SDL_Color _hex_to_color(char *hex, int alpha)
+{
+    SDL_Color color;
+    int rgba[3];
+    
+    _hex_to_rgba(hex, rgba);
+    color.r = (Uint8)rgba[0];
+    color.g = (Uint8)rgba[1];
+    color.b = (Uint8)rgba[2];
+    color.a = (Uint8)alpha;
+    
+    return color;
+}
+
+static void _make_sprite_quad(const sprite_t *s, float x, float y, float w, float h, SDL_Color color, SDL_Vertex *quad)
+{
+    /* Clockwise from the top left corner */
+    quad[0] = (SDL_Vertex){ {x, y}, color, {s->u0, s->v0} };
+    quad[1] = (SDL_Vertex){ {x + w, y}, color, {s->u1, s->v0} };
+    quad[2] = (SDL_Vertex){ {x + w, y + h}, color, {s->u1, s->v1} };
+    quad[3] = (SDL_Vertex){ {x, y + h}, color, {s->u0, s->v1} };
+}
+
+static void _sprite_batch_append(int atlas, const SDL_Vertex *quads, size_t vertex_count)
+{
+    size_t first, index_count;
+    
+    if (vertex_count == 0) return;
+    
+    /* Submit the batch when switching atlas, so sprites stay in draw order */
+    if (sprite_batch.atlas != atlas){
+        _flush_sprite_batch();
+        sprite_batch.atlas = atlas;
+    }
+    
+    first = SDL_Vertex_darray_count(sprite_batch.vertices);
+    index_count = int_darray_count(sprite_batch.indices);
+    SDL_Vertex_darray_resize(&sprite_batch.vertices, first + vertex_count);
+    int_darray_resize(&sprite_batch.indices, index_count + vertex_count / 4 * 6);
+    
+    /* Write straight into the new items */
+    memcpy(sprite_batch.vertices + first, quads, vertex_count * sizeof(SDL_Vertex));
+    _build_quad_indices(sprite_batch.indices + index_count, first, vertex_count / 4);
+}
+
+static float _emitter_randf(tk_emitter_t *emitter, float min, float max)
+{
+    /* xorshift32, cheaper than rand() and private to the emitter */
+    Uint32 state = emitter->random_state;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    emitter->random_state = state;
+    
+    return min + (max - min) * ((float)(state >> 8) * (1.0f / 16777216.0f));
+}
+
+static void _emitter_integrate(float *restrict x, float *restrict y, const float *restrict dx, const float *restrict dy,
+                               float *restrict life, size_t count, float dt)
+{
+    size_t i;
+    
+    /* Plain loops over separate pools, so that the compiler can vectorize them */
+    _integrate_axis(x, dx, count, dt);
+    _integrate_axis(y, dy, count, dt);
+    for (i = 0; i < count; i++){
+        life[i] -= dt;
+    }
+}
+
+static void _integrate_axis(float *restrict position, const float *restrict velocity, size_t count, float dt)
+{
+    size_t i;
+    
+    for (i = 0; i < count; i++){
+        position[i] += velocity[i] * dt;
+    }
+}
+
+static void _build_quad_indices(int *indices, size_t first_vertex, size_t quad_count)
+{
+    size_t i;
+    
+    /* Two triangles per quad: top left, top right, bottom right and top left, bottom right, bottom left */
+    for (i = 0; i < quad_count; i++){
+        const int v = (int)(first_vertex + i * 4);
+        indices[i * 6 + 0] = v;
+        indices[i * 6 + 1] = v + 1;
+        indices[i * 6 + 2] = v + 2;
+        indices[i * 6 + 3] = v;
+        indices[i * 6 + 4] = v + 2;
+        indices[i * 6 + 5] = v + 3;
+    }
+}
+
+static size_t _rewind_encode_delta(tk_rewind_t *rewind, const unsigned char *frame)
+{
+    /*
+Delta format, applied with XOR against the previous frame:
+u8 number of unchanged bytes to skip
+u8 number of changed bytes that follow
+changed bytes (frame ^ previous)
+repeated until the end of the frame. Worst case is 2 bytes of overhead per changed byte.
+*/
+    const unsigned char *previous = rewind->latest;
+    unsigned char *out = rewind->encoded;
+    size_t i = 0, size = 0, n = rewind->frame_size;
+    unsigned char skip, length;
+    
+    while (i < n){
+        skip = 0;
+        while (i < n && skip < 255 && frame[i] == previous[i]){
+            skip++;
+            i++;
+        }
+        
+        length = 0;
+        while (i + length < n && length < 255 && frame[i + length] != previous[i + length]){
+            out[size + 2 + length] = frame[i + length] ^ previous[i + length];
+            length++;
+        }
+        
+        /* Trailing unchanged bytes need no token */
+        if (length == 0 && i >= n) break;
+        
+        out[size] = skip;
+        out[size + 1] = length;
+        size += 2 + length;
+        i += length;
+    }
+    
+    return size;
+}
+
+static void _rewind_apply_delta(unsigned char *frame, const unsigned char *delta, size_t size)
+{
+    size_t read = 0, i;
+    unsigned char length;
+    
+    while (read < size){
+        frame += delta[read];
+        length = delta[read + 1];
+        for (i = 0; i < length; i++){
+            frame[i] ^= delta[read + 2 + i];
+        }
+        frame += length;
+        read += 2 + length;
+    }
+}
+
+static bool _rewind_find_space(tk_rewind_t *rewind, size_t size, size_t *offset)
+{
+    size_t tail;
+    
+    if (rewind->count == 0){
+        *offset = 0;
+        return size <= rewind->data_capacity;
+    }
+    
+    tail = rewind->records[rewind->first].offset;
+    if (tail < rewind->head){
+        /* Used bytes are [tail, head), free bytes are after head and before tail */
+        if (rewind->head + size <= rewind->data_capacity){
+            *offset = rewind->head;
+            return true;
+        }
+        if (size <= tail){
+            *offset = 0;
+            return true;
+        }
+        return false;
+    }
+    
+    /* Used bytes wrap around, free bytes are [head, tail) */
+    if (rewind->head + size <= tail){
+        *offset = rewind->head;
+        return true;
+    }
+    
+    return false;
+}
+
+static void _rewind_drop_oldest(tk_rewind_t *rewind)
+{
+    /* The oldest record is always a keyframe, drop it and the deltas built on it */
+    do{
+        rewind->first = (rewind->first + 1) % rewind->record_capacity;
+        rewind->count--;
+    }while (rewind->count > 0 && !rewind->records[rewind->first].keyframe);
+    
+    if (rewind->count == 0){
+        rewind->head = 0;
+    }
+}
+
+static tk_entity_t _entity_handle(tk_world_t *world, Uint32 index)
+{
+    return ((tk_entity_t)world->generations[index] << ENTITY_INDEX_BITS) | index;
+}
+
+static Uint32 _fnv1a(const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    Uint32 hash = 2166136261u;
+    size_t i;
+    
+    for (i = 0; i < size; i++){
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    
+    return hash;
+}
+
+static Uint32 _hashmap_hash(const tk_hashmap_t *map, const void *key)
+{
+    Uint32 hash = _fnv1a(key, map->key_size);
+    
+    /* Mix the high bits into the low bits used for the home slot, small integer keys differ only in a few bits */
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    
+    /* 0 marks an empty slot */
+    return hash ? hash : 1;
+}
+
+static size_t _hashmap_find_slot(const tk_hashmap_t *map, const void *key, Uint32 hash)
+{
+    const size_t mask = map->capacity - 1;
+    size_t slot = hash & mask;
+    size_t distance;
+    
+    for (distance = 0; map->hashes[slot] != 0; distance++){
+        /* An item closer to its home than the key would be: the key would have taken this slot */
+        if (((slot - map->hashes[slot]) & mask) < distance) break;
+        
+        if (map->hashes[slot] == hash && memcmp(map->keys + slot * map->key_size, key, map->key_size) == 0){
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    
+    return SIZE_MAX;
+}
+
+static size_t _hashmap_place(tk_hashmap_t *map, const void *key, const void *item, Uint32 hash)
+{
+    const size_t mask = map->capacity - 1;
+    const size_t entry_size = map->key_size + map->item_size;
+    char *carry = map->carry;
+    char *swap = map->carry + entry_size;
+    size_t slot = hash & mask;
+    size_t distance = 0, slot_distance, placed = SIZE_MAX;
+    Uint32 swap_hash;
+    
+    /* The carried entry is the new one at first, then whichever item it displaced */
+    memcpy(carry, key, map->key_size);
+    memcpy(carry + map->key_size, item, map->item_size);
+    
+    while (map->hashes[slot] != 0){
+        slot_distance = (slot - map->hashes[slot]) & mask;
+        if (slot_distance < distance){
+            memcpy(swap, map->keys + slot * map->key_size, map->key_size);
+            memcpy(swap + map->key_size, map->items + slot * map->item_size, map->item_size);
+            memcpy(map->keys + slot * map->key_size, carry, map->key_size);
+            memcpy(map->items + slot * map->item_size, carry + map->key_size, map->item_size);
+            swap_hash = map->hashes[slot];
+            map->hashes[slot] = hash;
+            hash = swap_hash;
+            carry = swap;
+            swap = (swap == map->carry) ? map->carry + entry_size : map->carry;
+            if (placed == SIZE_MAX) placed = slot;
+            distance = slot_distance;
+        }
+        slot = (slot + 1) & mask;
+        distance++;
+    }
+    
+    map->hashes[slot] = hash;
+    memcpy(map->keys + slot * map->key_size, carry, map->key_size);
+    memcpy(map->items + slot * map->item_size, carry + map->key_size, map->item_size);
+    
+    return (placed == SIZE_MAX) ? slot : placed;
 }
 
-int tk_list_pop_front(tk_node_t **list, int flag)
+static void _hashmap_rehash(tk_hashmap_t *map, size_t capacity)
 {
-    tk_node_t *tmp;
+    Uint32 *old_hashes = map->hashes;
+    char *old_keys = map->keys;
+    char *old_items = map->items;
+    size_t old_capacity = map->capacity;
+    size_t i;
+    char *block;
     
-    if ((*list)->next == NULL) return 1;
-    tmp = *list;
+    /* One block per table: hashes, keys, items */
+    block = MEM_ALLOC_LIKE(capacity * (sizeof(Uint32) + map->key_size + map->item_size), map);
+    if (!block) exit(1);
+    memset(block, 0, capacity * sizeof(Uint32));
     
-    *list = tmp->next;
-    if (flag) free(tmp->data);
-    free(tmp);
+    map->hashes = (Uint32*)block;
+    map->keys = block + capacity * sizeof(Uint32);
+    map->items = map->keys + capacity * map->key_size;
+    map->capacity = capacity;
     
-    return 0;
+    for (i = 0; i < old_capacity; i++){
+        if (old_hashes[i] != 0){
+            _hashmap_place(map, old_keys + i * map->key_size, old_items + i * map->item_size, old_hashes[i]);
+        }
+    }
+    
+    MEM_FREE(old_hashes);
 }
 
-int tk_list_push_back(tk_node_t *list, void* data)
+static void _font_init(void)
 {
-    tk_node_t *new_node, *back_node;
+    Uint32 pixels[FONT_GLYPH_WIDTH * FONT_GLYPH_HEIGHT];
+    int glyph, row, column;
     
-    new_node = malloc(sizeof(tk_node_t));
-    if (!new_node){
-        return -1;
+    font.atlas = tk_atlas_create(FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT);
+    if (font.atlas < 0) exit(1);
+    
+    /* Glyphs are white, so that the vertex color tints them */
+    for (glyph = 0; glyph < FONT_GLYPH_COUNT; glyph++){
+        for (row = 0; row < FONT_GLYPH_HEIGHT; row++){
+            for (column = 0; column < FONT_GLYPH_WIDTH; column++){
+                bool set = (font_glyphs[glyph][row] >> (FONT_GLYPH_WIDTH - 1 - column)) & 1;
+                Uint8 *pixel = (Uint8*)&pixels[row * FONT_GLYPH_WIDTH + column];
+                pixel[0] = pixel[1] = pixel[2] = 255;
+                pixel[3] = set ? 255 : 0;
+            }
+        }
+        
+        if (glyph == 0){
+            font.first_sprite = tk_sprite_load_rgba(font.atlas, pixels, FONT_GLYPH_WIDTH, FONT_GLYPH_HEIGHT);
+        }
+        else{
+            tk_sprite_load_rgba(font.atlas, pixels, FONT_GLYPH_WIDTH, FONT_GLYPH_HEIGHT);
+        }
     }
     
-    new_node->data = data;
-    new_node->next = NULL;
+    text_scratch = SDL_Vertex_darray_create();
+}
+
+static void _font_destroy(void)
+{
+    int i;
     
-    back_node = tk_list_get_back(list); 
-    back_node->next = new_node;
+    for (i = 0; i < TEXT_CACHE_SIZE; i++){
+        if (text_cache[i].vertices) SDL_Vertex_darray_destroy(text_cache[i].vertices);
+    }
+    memset(text_cache, 0, sizeof(text_cache));
+    SDL_Vertex_darray_destroy(text_scratch);
+}
+
+static void _layout_text(const char *text, int x, int y, int scale, SDL_Color color, SDL_Vertex **vertices)
+{
+    float pen_x = (float)x, pen_y = (float)y;
+    float glyph_w = (float)(FONT_GLYPH_WIDTH * scale), glyph_h = (float)(FONT_GLYPH_HEIGHT * scale);
+    SDL_Vertex quad[4];
+    int c, i;
     
-    return 0;
+    for (; *text; text++){
+        c = (unsigned char)*text;
+        
+        if (c == '\n'){
+            pen_x = (float)x;
+            pen_y += (float)(FONT_LINE_HEIGHT * scale);
+            continue;
+        }
+        
+        /* The font only has upper case letters */
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c < FONT_FIRST_CHAR || c >= FONT_FIRST_CHAR + FONT_GLYPH_COUNT) c = '?';
+        
+        if (c != ' '){
+            _make_sprite_quad(&sprites[font.first_sprite + c - FONT_FIRST_CHAR], pen_x, pen_y, glyph_w, glyph_h, color, quad);
+            for (i = 0; i < 4; i++){
+                SDL_Vertex_darray_push(vertices, quad[i]);
+            }
+        }
+        pen_x += (float)(FONT_ADVANCE * scale);
+    }
 }
 
-int tk_list_pop_back(tk_node_t *list, int flag)
+static text_cache_entry_t* _text_cache_get(const char *text, size_t length, int x, int y, int scale, SDL_Color color)
 {
-    tk_node_t *current;
+    text_cache_entry_t *entry, *oldest = &text_cache[0];
+    Uint32 hash = _fnv1a(text, length);
+    size_t i;
     
-    if (list->next == NULL) return 1;
+    text_cache_clock++;
+    for (i = 0; i < TEXT_CACHE_SIZE; i++){
+        entry = &text_cache[i];
+        if (entry->vertices && entry->hash == hash && entry->x == x && entry->y == y && entry->scale == scale &&
+            memcmp(&entry->color, &color, sizeof(SDL_Color)) == 0 && strcmp(entry->text, text) == 0){
+            entry->last_used = text_cache_clock;
+            return entry;
+        }
+        if (entry->last_used < oldest->last_used) oldest = entry;
+    }
     
-    current = list;
-    while (current->next->next != NULL){
-        current = current->next;
+    /* Not cached yet, lay out the string into the least recently used entry */
+    entry = oldest;
+    if (!entry->vertices){
+        entry->vertices = SDL_Vertex_darray_create();
     }
+    SDL_Vertex_darray_clear(entry->vertices);
+    _layout_text(text, x, y, scale, color, &entry->vertices);
     
-    if (flag) free(current->next->data);
-    free(current->next);
-    current->next = NULL;
+    memcpy(entry->text, text, length + 1);
+    entry->hash = hash;
+    entry->x = x;
+    entry->y = y;
+    entry->scale = scale;
+    entry->color = color;
+    entry->last_used = text_cache_clock;
     
-    return 0;
+    return entry;
 }
 
-tk_node_t* tk_list_get_back(tk_node_t *list)
+static void _flush_sprite_batch(void)
 {
-    tk_node_t *current;
+    size_t index_count = int_darray_count(sprite_batch.indices);
     
-    current = list;
-    while (current->next != NULL){
-        current = current->next;
+    if (index_count == 0) return;
+    
+    SDL_RenderGeometry(app.renderer, atlases[sprite_batch.atlas].texture,
+                       sprite_batch.vertices, (int)SDL_Vertex_darray_count(sprite_batch.vertices),
+                       sprite_batch.indices, (int)index_count);
+    
+    SDL_Vertex_darray_clear(sprite_batch.vertices);
+    int_darray_clear(sprite_batch.indices);
+}
+
+static void _frame_arena_init(size_t size, bool double_buffered)
+{
+    int i, block_count = double_buffered ? 2 : 1;
+    
+    frame_arena.size = size;
+    frame_arena.double_buffered = double_buffered;
+    
+    for (i = 0; i < block_count; i++){
+        frame_arena.blocks[i] = MEM_ALLOC(size);
+        if (!frame_arena.blocks[i]) exit(1);
+    }
+}
+
+static void _frame_arena_destroy(void)
+{
+    MEM_FREE(frame_arena.blocks[0]);
+    MEM_FREE(frame_arena.blocks[1]);
+    memset(&frame_arena, 0, sizeof(frame_arena));
+}
+
+static void _frame_arena_reset(void)
+{
+    size_t used = (size_t)SDL_AtomicGet(&frame_arena.offset);
+    
+    if (used > frame_arena.high_water){
+        frame_arena.high_water = used;
     }
     
-    return current;
+    /* Double buffered arenas switch block, so the last frame's block stays untouched for one more frame */
+    if (frame_arena.double_buffered){
+        frame_arena.current = !frame_arena.current;
+    }
+    
+    SDL_AtomicSet(&frame_arena.offset, 0);
 }
 
-tk_node_t* tk_list_find(tk_node_t *list, void *data)
+static void _job_system_init(int worker_count)
 {
-    tk_node_t *current;
+    int i;
     
-    current = list;
-    while (current != NULL && current->data != data){
-        current = current->next;
+    if (worker_count < 0){
+        worker_count = SDL_GetCPUCount() - 1;
+        if (worker_count < 0) worker_count = 0;
     }
     
-    /* If current is null, it means the function could not find the data */
-    return current;
+    job_system.worker_count = worker_count;
+    job_system.tls = SDL_TLSCreate();
+    job_system.wake = SDL_CreateSemaphore(0);
+    job_system.deferred = job_t_darray_create();
+    
+    job_system.queues = MEM_ALLOC(sizeof(job_queue_t) * (worker_count + 1));
+    if (!job_system.queues) exit(1);
+    memset(job_system.queues, 0, sizeof(job_queue_t) * (worker_count + 1));
+    
+    job_system.threads = MEM_ALLOC(sizeof(SDL_Thread*) * (worker_count + 1));
+    if (!job_system.threads) exit(1);
+    
+    for (i = 0; i < worker_count; i++){
+        job_system.threads[i] = SDL_CreateThread(_job_worker, "tk_job_worker", (void*)(intptr_t)(i + 1));
+        if (!job_system.threads[i]){
+            printf("Could not create job worker thread: %s\n", SDL_GetError());
+            exit(1);
+        }
+    }
 }
 
-int tk_list_insert_after(tk_node_t *list, void* data_to_insert, void *data_to_find)
+static void _job_system_destroy(void)
 {
-    tk_node_t *current, *node_to_insert;
+    int i;
     
-    current = tk_list_find(list, data_to_find);
-    if (!current){
-        return -1; /* return -1 on fail to find the node*/
+    SDL_AtomicSet(&job_system.quit, 1);
+    for (i = 0; i < job_system.worker_count; i++){
+        SDL_SemPost(job_system.wake);
+    }
+    for (i = 0; i < job_system.worker_count; i++){
+        SDL_WaitThread(job_system.threads[i], NULL);
     }
     
-    node_to_insert = malloc(sizeof(tk_node_t));
-    if (!node_to_insert){
+    SDL_DestroySemaphore(job_system.wake);
+    job_t_darray_destroy(job_system.deferred);
+    MEM_FREE(job_system.queues);
+    MEM_FREE(job_system.threads);
+    memset(&job_system, 0, sizeof(job_system));
+}
+
+int tk_get_worker_count(void)
+{
+    return job_system.worker_count;
+}
+
+void tk_job_run(tk_job_fn fn, void *data, tk_job_counter_t *counter)
+{
+    tk_job_run_after(fn, data, counter, NULL);
+}
+
+void tk_job_run_after(tk_job_fn fn, void *data, tk_job_counter_t *counter, tk_job_counter_t *dependency)
+{
+    job_t job = {0};
+    
+    job.fn = fn;
+    job.data = data;
+    job.counter = counter;
+    job.dependency = dependency;
+    
+    if (counter) SDL_AtomicAdd(&counter->pending, 1);
+    
+    if (dependency){
+        /*
+        Announce the job before looking at the dependency. _job_execute() drops pending before reading deferred_count,
+        so either it sees this job and calls _job_release_deferred(), which waits for the lock, or we see pending at 0.
+        */
+        SDL_AtomicLock(&job_system.deferred_lock);
+        SDL_AtomicAdd(&job_system.deferred_count, 1);
+        if (SDL_AtomicGet(&dependency->pending) > 0){
+            job_t_darray_push(&job_system.deferred, job);
+            SDL_AtomicUnlock(&job_system.deferred_lock);
+            return;
+        }
+        SDL_AtomicAdd(&job_system.deferred_count, -1);
+        SDL_AtomicUnlock(&job_system.deferred_lock);
+    }
+    
+    _job_submit(&job);
+}
+
+void tk_job_parallel_for(size_t count, size_t grain, tk_job_range_fn fn, void *data, tk_job_counter_t *counter)
+{
+    tk_job_counter_t local_counter = {0};
+    job_t job = {0};
+    size_t begin;
+    
+    if (grain == 0){
+        /* A few jobs per thread, so that stealing can even out uneven ranges */
+        grain = count / ((size_t)(job_system.worker_count + 1) * 4);
+        if (grain == 0) grain = 1;
+    }
+    
+    job.range_fn = fn;
+    job.data = data;
+    job.counter = counter ? counter : &local_counter;
+    
+    for (begin = 0; begin < count; begin += grain){
+        job.begin = begin;
+        job.end = (count - begin > grain) ? begin + grain : count;
+        SDL_AtomicAdd(&job.counter->pending, 1);
+        _job_submit(&job);
+    }
+    
+    if (!counter){
+        tk_job_wait(&local_counter);
+    }
+}
+
+void tk_job_wait(tk_job_counter_t *counter)
+{
+    int index = _job_current_queue();
+    job_t job;
+    
+    while (SDL_AtomicGet(&counter->pending) > 0){
+        if (_job_get(index, &job)){
+            _job_execute(&job);
+        }
+    }
+}
+
+bool tk_job_is_done(tk_job_counter_t *counter)
+{
+    return SDL_AtomicGet(&counter->pending) == 0;
+}
+
+/*=== Audio functions ===*/
+static void _audio_init(int buffer_size)
+{
+    SDL_AudioSpec desired = {0};
+    
+    /* Audio is optional, the game keeps running without it */
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0){
+        printf("Could not initialize SDL audio: %s\n", SDL_GetError());
+        return;
+    }
+    
+    desired.freq = AUDIO_FREQUENCY;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 1;
+    desired.samples = (Uint16)buffer_size;
+    desired.callback = _audio_callback;
+    
+    /* No allowed changes, SDL converts to the device format if it has to */
+    audio.device = SDL_OpenAudioDevice(NULL, 0, &desired, NULL, 0);
+    if (!audio.device){
+        printf("Could not open audio device: %s\n", SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return;
+    }
+    
+    SDL_PauseAudioDevice(audio.device, 0);
+}
+
+static void _audio_destroy(void)
+{
+    int i;
+    
+    if (!audio.device) return;
+    
+    /* Closing waits for a running callback, so the samples can be freed afterwards */
+    SDL_CloseAudioDevice(audio.device);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    for (i = 0; i < audio.sound_count; i++){
+        MEM_FREE(audio.sounds[i].samples);
+    }
+    memset(&audio, 0, sizeof(audio));
+}
+
+int tk_sound_load_wav(char *path)
+{
+    SDL_AudioSpec spec;
+    Uint8 *data;
+    Uint32 size;
+    int sound;
+    
+    if (!audio.device) return -1;
+    
+    if (!SDL_LoadWAV(path, &spec, &data, &size)){
+        printf("Could not load sound %s: %s\n", path, SDL_GetError());
         return -1;
     }
     
-    node_to_insert->data = data_to_insert;
-    node_to_insert->next = current->next;
-    current->next = node_to_insert;
+    sound = _sound_add(spec.format, spec.channels, spec.freq, data, size);
+    SDL_FreeWAV(data);
+    
+    return sound;
+}
+
+int tk_sound_load_pcm(const Sint16 *samples, size_t count, int frequency)
+{
+    if (!audio.device) return -1;
+    
+    return _sound_add(AUDIO_S16SYS, 1, frequency, (const Uint8*)samples, (Uint32)(count * sizeof(Sint16)));
+}
+
+int tk_sound_play(int sound, float volume)
+{
+    voice_t *request;
+    int tail, next;
+    
+    if (!audio.device || sound < 0 || sound >= audio.sound_count) return -1;
+    
+    tail = SDL_AtomicGet(&audio.queue.tail);
+    next = (tail + 1) & (AUDIO_QUEUE_CAPACITY - 1);
+    if (next == SDL_AtomicGet(&audio.queue.head)) return -1; /* Full, the callback is behind */
+    
+    request = &audio.queue.requests[tail];
+    request->samples = audio.sounds[sound].samples;
+    request->length = audio.sounds[sound].length;
+    request->position = 0;
+    request->volume = (int)(tkmt_clampf(volume, 0.0f, 1.0f) * 256.0f);
+    
+    /* The request has to be visible before the callback sees the new tail */
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&audio.queue.tail, next);
     
     return 0;
 }
 
+static int _sound_add(SDL_AudioFormat format, Uint8 channels, int frequency, const Uint8 *data, Uint32 size)
+{
+    SDL_AudioCVT cvt;
+    Uint8 *buffer;
+    
+    if (audio.sound_count >= MAX_SOUNDS){
+        printf("Could not add sound: more than %d sounds\n", MAX_SOUNDS);
+        return -1;
+    }
+    
+    /* Convert once at load time, so that the callback only has to add samples */
+    if (SDL_BuildAudioCVT(&cvt, format, channels, frequency, AUDIO_S16SYS, 1, AUDIO_FREQUENCY) < 0){
+        printf("Could not convert sound: %s\n", SDL_GetError());
+        return -1;
+    }
+    
+    cvt.len = (int)size;
+    buffer = MEM_ALLOC((size_t)size * (size_t)cvt.len_mult);
+    if (!buffer) exit(1);
+    memcpy(buffer, data, size);
+    cvt.buf = buffer;
+    
+    if (cvt.needed){
+        if (SDL_ConvertAudio(&cvt) < 0){
+            printf("Could not convert sound: %s\n", SDL_GetError());
+            MEM_FREE(buffer);
+            return -1;
+        }
+        size = (Uint32)cvt.len_cvt;
+    }
+    
+    audio.sounds[audio.sound_count].samples = (Sint16*)buffer;
+    audio.sounds[audio.sound_count].length = size / sizeof(Sint16);
+    
+    return audio.sound_count++;
+}
+
+static void _audio_callback(void *userdata, Uint8 *stream, int length)
+{
+    Sint16 *out = (Sint16*)stream;
+    size_t frames = (size_t)length / sizeof(Sint16);
+    int head, tail, i;
+    size_t chunk, j, n;
+    Sint32 sample;
+    
+    (void)userdata;
+    
+    /* Start the requested sounds. A request with no free voice is dropped */
+    head = SDL_AtomicGet(&audio.queue.head);
+    tail = SDL_AtomicGet(&audio.queue.tail);
+    SDL_MemoryBarrierAcquire();
+    while (head != tail){
+        for (i = 0; i < MAX_VOICES; i++){
+            if (!audio.voices[i].samples){
+                audio.voices[i] = audio.queue.requests[head];
+                break;
+            }
+        }
+        head = (head + 1) & (AUDIO_QUEUE_CAPACITY - 1);
+    }
+    SDL_AtomicSet(&audio.queue.head, head);
+    
+    /* Mix in chunks, wide enough to sum all voices without clipping in between */
+    while (frames > 0){
+        chunk = (frames < AUDIO_MIX_CHUNK) ? frames : AUDIO_MIX_CHUNK;
+        memset(audio.mix, 0, chunk * sizeof(Sint32));
+        
+        for (i = 0; i < MAX_VOICES; i++){
+            voice_t *voice = &audio.voices[i];
+            if (!voice->samples) continue;
+            
+            n = voice->length - voice->position;
+            if (n > chunk) n = chunk;
+            for (j = 0; j < n; j++){
+                audio.mix[j] += voice->samples[voice->position + j] * voice->volume;
+            }
+            
+            voice->position += n;
+            if (voice->position >= voice->length){
+                voice->samples = NULL;
+            }
+        }
+        
+        for (j = 0; j < chunk; j++){
+            sample = audio.mix[j] >> 8;
+            out[j] = (Sint16)((sample > 32767) ? 32767 : (sample < -32768) ? -32768 : sample);
+        }
+        
+        out += chunk;
+        frames -= chunk;
+    }
+}
+
 /* === Internal functions === */
+#ifdef TK_TRACK_ALLOCATIONS
+static void _alloc_stats_add(tk_alloc_stats_t *stats, size_t size)
+{
+    stats->live_count++;
+    stats->live_bytes += size;
+    stats->total_count++;
+    if (stats->live_bytes > stats->peak_bytes) stats->peak_bytes = stats->live_bytes;
+}
+
+static void _alloc_stats_remove(tk_alloc_stats_t *stats, size_t size)
+{
+    stats->live_count--;
+    stats->live_bytes -= size;
+}
+#endif
+
+static void* _mem_alloc(size_t size, const char *name, int line)
+{
+#ifdef TK_TRACK_ALLOCATIONS
+    size_t site;
+    
+    SDL_AtomicLock(&alloc_lock);
+    for (site = 0; site < alloc_site_count; site++){
+        if (alloc_sites[site].line == line &&
+            (alloc_sites[site].name == name || strcmp(alloc_sites[site].name, name) == 0)) break;
+    }
+    /* Past MAX_ALLOC_SITES allocations are only counted in the totals */
+    if (site == alloc_site_count && alloc_site_count < MAX_ALLOC_SITES){
+        alloc_sites[alloc_site_count].name = name;
+        alloc_sites[alloc_site_count].line = line;
+        alloc_site_count++;
+    }
+    SDL_AtomicUnlock(&alloc_lock);
+    
+    return _mem_alloc_tracked(size, site);
+#else
+    (void)name;
+    (void)line;
+    
+    return allocator.alloc ? allocator.alloc(size, allocator.user) : malloc(size);
+#endif
+}
+
+static void* _mem_alloc_like(size_t size, const void *like, const char *name)
+{
+#ifdef TK_TRACK_ALLOCATIONS
+    /* The site is kept in the tracking header of the other block */
+    if (like) return _mem_alloc_tracked(size, ((const alloc_header_t*)like - 1)->site);
+#else
+    (void)like;
+#endif
+    
+    return _mem_alloc(size, name, 0);
+}
+
+#ifdef TK_TRACK_ALLOCATIONS
+static void* _mem_alloc_tracked(size_t size, size_t site)
+{
+    alloc_header_t *header;
+    
+    header = allocator.alloc ? allocator.alloc(size + sizeof(alloc_header_t), allocator.user)
+        : malloc(size + sizeof(alloc_header_t));
+    if (!header) return NULL;
+    
+    header->size = size;
+    header->site = site;
+    
+    SDL_AtomicLock(&alloc_lock);
+    if (site < alloc_site_count) _alloc_stats_add(&alloc_sites[site].stats, size);
+    _alloc_stats_add(&alloc_stats, size);
+    SDL_AtomicUnlock(&alloc_lock);
+    
+    return header + 1;
+}
+#endif
+
+static void _mem_free(void *ptr)
+{
+#ifdef TK_TRACK_ALLOCATIONS
+    alloc_header_t *header;
+#endif
+    
+    if (!ptr) return;
+    
+#ifdef TK_TRACK_ALLOCATIONS
+    header = (alloc_header_t*)ptr - 1;
+    
+    SDL_AtomicLock(&alloc_lock);
+    if (header->site < alloc_site_count) _alloc_stats_remove(&alloc_sites[header->site].stats, header->size);
+    _alloc_stats_remove(&alloc_stats, header->size);
+    SDL_AtomicUnlock(&alloc_lock);
+    
+    ptr = header;
+#endif
+    
+    if (allocator.free){
+        allocator.free(ptr, allocator.user);
+    }
+    else{
+        free(ptr);
+    }
+}
+
+static float _fold_y(float y, float range)
+{
+    /* Bouncing between 0 and range is a triangle wave with a period of 2 * range */
+    float period = 2.0f * range;
+    
+    if (range <= 0.0f) return 0.0f;
+    
+    y -= period * floorf(y / period);
+    
+    return (y > range) ? period - y : y;
+}
+
 static void _hex_to_rgba(char *hex, int* rgba){
     int i, j;
-    char tmp[2];
+    char tmp[3];
     
+    tmp[2] = '\0'; /* strtol needs a terminated string */
     j = 0;
     for (i = 0; i < 5; i += 2){
         tmp[0] = hex[i];
@@ -548,22 +2971,88 @@ static void _update_key_state(void)
 {
     SDL_Event event;
     while (SDL_PollEvent(&event)){
-        switch (event.type){
-            case SDL_QUIT: { app.should_quit = true; }break;
-            
-            case SDL_KEYDOWN:{
-                if (!event.key.repeat){
-                    _set_key_state(event.key.keysym.scancode, 1);
-                }
-            }break;
-            
-            case SDL_KEYUP:{
-                if (!event.key.repeat){
-                    _set_key_state(event.key.keysym.scancode, 0);
-                }
-            }break;
+        _handle_event(&event);
+    }
+}
+
+static void _handle_event(const SDL_Event *event)
+{
+    switch (event->type){
+        case SDL_QUIT: { app.should_quit = true; }break;
+        
+        case SDL_KEYDOWN:{
+            if (!event->key.repeat){
+                _set_key_state(event->key.keysym.scancode, 1);
+            }
+        }break;
+        
+        case SDL_KEYUP:{
+            if (!event->key.repeat){
+                _set_key_state(event->key.keysym.scancode, 0);
+            }
+        }break;
+        
+        case SDL_WINDOWEVENT:{
+            switch (event->window.event){
+                case SDL_WINDOWEVENT_FOCUS_GAINED:{ app.unfocused = false; }break;
+                case SDL_WINDOWEVENT_FOCUS_LOST:{
+                    /* The key up events go to the other window, do not leave keys stuck down */
+                    app.unfocused = true;
+                    memset(&key_state, 0, sizeof(key_state));
+                }break;
+            }
+        }break;
+    }
+}
+
+static void _update_idle(void)
+{
+    bool idle;
+    Uint64 counter;
+    clock_t cpu;
+    double seconds, cpu_seconds, saved;
+    
+    /* Read from the window, a minimized window can come back maximized without a restored event */
+    app.minimized = (SDL_GetWindowFlags(app.window) & SDL_WINDOW_MINIMIZED) != 0;
+    idle = app.minimized || app.unfocused || app.idle_requested;
+    if (idle == app.idle) return;
+    
+    counter = SDL_GetPerformanceCounter();
+    cpu = clock();
+    seconds = (double)(counter - app.period_start) / (double)SDL_GetPerformanceFrequency();
+    cpu_seconds = (double)(cpu - app.period_start_cpu) / CLOCKS_PER_SEC;
+    
+    if (idle){
+        /* The active period that just ended tells how much CPU the same time would have cost */
+        if (seconds >= MIN_ACTIVE_PERIOD){
+            app.active_cpu_ratio = cpu_seconds / seconds;
         }
     }
+    else{
+        saved = (seconds * app.active_cpu_ratio) - cpu_seconds;
+        if (saved < 0.0) saved = 0.0;
+        app.idle_cpu_saved += saved;
+        app.last_idle_period.index++;
+        app.last_idle_period.seconds = seconds;
+        app.last_idle_period.cpu_used = cpu_seconds;
+        app.last_idle_period.cpu_saved = saved;
+    }
+    
+    app.idle = idle;
+    app.period_start = counter;
+    app.period_start_cpu = cpu;
+}
+
+static void _wait_idle(int fps)
+{
+    double elapsed = (double)(SDL_GetPerformanceCounter() - now) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    int time_to_wait = (1000 / fps) - (int)elapsed;
+    SDL_Event event;
+    
+    /* Sleep in the event queue, so that input wakes the app up at once */
+    if (time_to_wait > 0 && SDL_WaitEventTimeout(&event, time_to_wait)){
+        _handle_event(&event);
+    }
 }
 
 static void _calculate_deltatime(void){
@@ -580,6 +3069,7 @@ static void _set_key_state(SDL_Scancode scancode, bool is_down){
         case SDL_SCANCODE_W:{ key_state.key_w = is_down; }break;
         case SDL_SCANCODE_S:{ key_state.key_s = is_down; }break;
         case SDL_SCANCODE_ESCAPE:{ key_state.key_esc = is_down; }break;
+        case SDL_SCANCODE_R:{ key_state.key_r = is_down; }break;
         default: { }break;
     }
 }
\ No newline at end of file
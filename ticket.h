@@ -30,6 +30,7 @@ typedef enum tk_key_id{ /* Key ids */
     TK_KEY_W,
     TK_KEY_S,
     TK_KEY_ESC,
+    TK_KEY_R,
 }tk_key_id_t;
 
 typedef struct tk_node_t{ /* A node of linked list */
@@ -37,6 +38,93 @@ typedef struct tk_node_t{ /* A node of linked list */
     struct tk_node_t *next;
 }tk_node_t;
 
+typedef struct tk_emitter{ /* A particle emitter. Particles are stored as one array per field */
+    float *x, *y;             /* Center positions */
+    float *dx, *dy;           /* Velocities */
+    float *life;              /* Seconds left to live */
+    float *inv_max_life;      /* 1 / lifetime at spawn, to fade out without dividing */
+    SDL_Color *color;
+    size_t count, capacity;
+    
+    /* Emission settings */
+    float emit_x, emit_y;
+    float rate;               /* Particles per second */
+    float rate_accumulator;   /* Fraction of a particle left over from the last update */
+    float min_dx, max_dx, min_dy, max_dy;
+    float min_life, max_life;
+    int size;
+    SDL_Color base_color;
+    Uint32 random_state;
+    
+    /* Drawing buffers */
+    SDL_Vertex *vertices;
+    int *indices;
+}tk_emitter_t;
+
+typedef Uint32 tk_entity_t; /* A generational entity handle, stale handles of destroyed entities are detected */
+
+#define TK_ENTITY_NONE 0 /* Never a valid handle */
+#define TK_ENTITY_NO_SLOT ((size_t)-1)
+#define TK_ENTITY_CLAMP 0x01 /* Kept inside the bounds by tk_world_clamp() */
+#define TK_ENTITY_SOLID 0x02 /* Reported by tk_world_collide() */
+
+typedef struct tk_world{ /* Entity storage. Components are packed arrays, slots 0 to count - 1 are live */
+    float *x, *y;             /* Top left positions */
+    float *dx, *dy;           /* Velocities */
+    float *w, *h;             /* Sizes */
+    SDL_Color *color;
+    Uint8 *flags;             /* TK_ENTITY_CLAMP, TK_ENTITY_SOLID */
+    Uint32 *owner;            /* Handle index of the entity in each slot */
+    size_t count, capacity;
+    
+    /* Handle index to slot mapping */
+    Uint32 *slots;
+    Uint16 *generations;
+    Uint32 *free_indices;
+    size_t free_count, index_count;
+    
+    /* Drawing buffers */
+    SDL_Vertex *vertices;
+    int *indices;
+}tk_world_t;
+
+typedef struct tk_allocator{ /* Memory functions used by every ticket.c container */
+    void* (*alloc)(size_t size, void *user);
+    void (*free)(void *ptr, void *user);
+    void *user;  /* Passed to alloc and free */
+}tk_allocator_t;
+
+typedef struct tk_alloc_stats{
+    size_t live_count;  /* Allocations not freed yet */
+    size_t live_bytes;
+    size_t peak_bytes;  /* Highest live_bytes so far */
+    size_t total_count; /* Allocations made so far */
+}tk_alloc_stats_t;
+
+typedef struct tk_idle_period{ /* CPU usage of an idle period, see tk_get_last_idle_period() */
+    int index;        /* 1 for the first idle period of the app, 2 for the next one... */
+    double seconds;   /* Length of the period */
+    double cpu_used;  /* CPU seconds used by the process during the period */
+    double cpu_saved; /* Estimate: CPU seconds the period would have used at the active rate, minus cpu_used */
+}tk_idle_period_t;
+
+typedef struct tk_snapshot{ /* A read / write cursor over a snapshot buffer */
+    unsigned char *data;
+    size_t size;   /* Capacity of data in bytes */
+    size_t cursor; /* Bytes written or read so far */
+}tk_snapshot_t;
+
+typedef struct tk_rewind tk_rewind_t; /* A history of fixed size frames, see tk_rewind_create() */
+
+typedef struct tk_hashmap tk_hashmap_t; /* Fixed size keys to fixed size items, see tk_hashmap_create() */
+
+typedef void (*tk_job_fn)(void *data); /* A job entry point */
+typedef void (*tk_job_range_fn)(size_t begin, size_t end, void *data); /* A parallel for entry point */
+
+typedef struct tk_job_counter{ /* Number of jobs still running, zero initialize before use */
+    SDL_atomic_t pending;
+}tk_job_counter_t;
+
 /* === App init & destrution functions === */
 extern void tk_app_init(char *title, int window_width, int window_height);
 extern void tk_app_destroy(void);
@@ -45,11 +133,57 @@ extern void tk_app_destroy(void);
 extern bool tk_app_should_quit(void);
 extern int tk_get_window_width(void);
 extern int tk_get_window_height(void);
+/**
+* @brief Return the duration of the last frame in seconds.
+* 0 while the window is minimized or not focused (and on the frame it comes back), so that the game stands still.
+*/
 extern double tk_get_deltatime(void);
+/**
+* @brief Return if the app is idle: minimized, not focused or declared idle with tk_set_idle().
+*/
+extern bool tk_is_idle(void);
+/**
+* @brief Return an estimate of the CPU time saved by idling so far, in seconds.
+*/
+extern double tk_get_idle_cpu_saved(void);
+/**
+* @brief Get the CPU usage of the last finished idle period.
+* @param period A ptr to store the period to. All zero if no idle period has finished yet.
+*/
+extern void tk_get_last_idle_period(tk_idle_period_t *period);
 
 /* === App data setters === */
 extern void tk_set_fps_target(int fps);
 extern void tk_set_should_quit(void);
+/**
+* @brief Declare a period where nothing on screen changes, e.g. a pause or count down.
+* While idle, tk_end_drawing() waits for events at the idle frame rate instead of the fps target,
+* and input ends the wait right away.
+* @param idle true at the start of the period, false at its end.
+*/
+extern void tk_set_idle(bool idle);
+/**
+* @brief Set the frame rate used while idle.
+* @param fps Frames per second (10 by default).
+*/
+extern void tk_set_idle_fps(int fps);
+/**
+* @brief Set the number of job worker threads. Must be called before tk_app_init().
+* @param count Number of worker threads. 0 = run jobs on the calling thread only (default), -1 = one per extra CPU core.
+*/
+extern void tk_set_worker_count(int count);
+/**
+* @brief Set the size of the frame arena used by tk_frame_alloc(). Must be called before tk_app_init().
+* @param size The size of the arena in bytes (1 MiB by default).
+* @param double_buffered If true, memory allocated in a frame stays valid until the end of the next frame.
+*/
+extern void tk_set_frame_arena(size_t size, bool double_buffered);
+/**
+* @brief Set the audio buffer size. Smaller buffers lower the latency but need the callback to run more often.
+* Must be called before tk_app_init().
+* @param samples Sample frames per audio callback, a power of 2 (512 by default, about 12 ms).
+*/
+extern void tk_set_audio_buffer_size(int samples);
 
 /* === Input related === */
 extern bool tk_is_key_down(tk_key_id_t key);
@@ -61,6 +195,328 @@ void tk_draw_rect_a(int x, int y, int w, int h, int alpha, char *color);
 extern void tk_draw_line(int x1, int y1, int x2, int y2, char *color);
 extern void tk_end_drawing(void);
 
+/* === Texture functions === */
+/**
+* @brief Create an empty texture atlas to load sprites into. Must be called after tk_app_init().
+* @param width The width of the atlas texture in pixels.
+* @param height The height of the atlas texture in pixels.
+* @return An atlas id, -1 on failure.
+*/
+extern int tk_atlas_create(int width, int height);
+
+/**
+* @brief Load a BMP image into an atlas.
+* @param atlas An atlas id returned by tk_atlas_create().
+* @param path A path to the BMP file.
+* @return A sprite handle, -1 if the file could not be loaded or the atlas is full.
+*/
+extern int tk_sprite_load(int atlas, const char *path);
+
+/**
+* @brief Copy raw pixels into an atlas.
+* @param atlas An atlas id returned by tk_atlas_create().
+* @param pixels A ptr to width * height pixels, 4 bytes each in R, G, B, A order.
+* @param width The width of the image in pixels.
+* @param height The height of the image in pixels.
+* @return A sprite handle, -1 if the atlas is full.
+*/
+extern int tk_sprite_load_rgba(int atlas, const void *pixels, int width, int height);
+
+/**
+* @brief Draw a sprite. Sprites are batched and submitted in one draw call per atlas switch.
+* @param sprite A sprite handle.
+* @param x, y The position of the top left corner.
+* @param w, h The size to draw the sprite at.
+* @param alpha An alpha value (0 - 255).
+* @param tint A color multiplied with the sprite's pixels, WHITE to draw the sprite as is.
+*/
+extern void tk_draw_sprite(int sprite, int x, int y, int w, int h, int alpha, char *tint);
+
+/* === Text functions === */
+/**
+* @brief Draw a string with the built-in 5x7 bitmap font. Lower case letters are drawn upper case.
+* The laid out string is cached, so drawing the same string at the same place every frame is cheap.
+* @param text A string to draw. '\n' starts a new line.
+* @param x, y The position of the top left corner.
+* @param scale A size multiplier, 1 = 5x7 pixels per glyph.
+* @param color A color of the text.
+*/
+extern void tk_draw_text(const char *text, int x, int y, int scale, char *color);
+
+/**
+* @brief Return the width of the widest line of the string in pixels.
+* @param text A string to measure.
+* @param scale A size multiplier passed to tk_draw_text().
+*/
+extern int tk_get_text_width(const char *text, int scale);
+
+/* === Particle functions === */
+/**
+* @brief Create a particle emitter. All memory is allocated here, emitting never allocates.
+* @param capacity A maximum number of live particles. New particles are dropped while full.
+* @return A ptr to the emitter.
+*/
+extern tk_emitter_t* tk_emitter_create(size_t capacity);
+
+/**
+* @brief Destroy a particle emitter.
+* @param emitter A ptr to the emitter.
+*/
+extern void tk_emitter_destroy(tk_emitter_t *emitter);
+
+/**
+* @brief Set where new particles spawn.
+* @param emitter A ptr to the emitter.
+* @param x, y The spawn position.
+*/
+extern void tk_emitter_set_position(tk_emitter_t *emitter, float x, float y);
+
+/**
+* @brief Set how many particles tk_emitter_update() spawns per second.
+* @param emitter A ptr to the emitter.
+* @param rate Particles per second, 0 to stop emitting.
+*/
+extern void tk_emitter_set_rate(tk_emitter_t *emitter, float rate);
+
+/**
+* @brief Set the range new particles pick their velocity and lifetime from.
+* @param emitter A ptr to the emitter.
+* @param min_dx, max_dx A range of the horizontal velocity.
+* @param min_dy, max_dy A range of the vertical velocity.
+* @param min_life, max_life A range of the lifetime in seconds.
+*/
+extern void tk_emitter_set_motion(tk_emitter_t *emitter, float min_dx, float max_dx, float min_dy, float max_dy,
+                                  float min_life, float max_life);
+
+/**
+* @brief Set the look of new particles. Particles fade out from alpha to 0 over their lifetime.
+* @param emitter A ptr to the emitter.
+* @param size A width and height of the particles in pixels.
+* @param alpha An alpha value at spawn (0 - 255).
+* @param color A color of the particles.
+*/
+extern void tk_emitter_set_style(tk_emitter_t *emitter, int size, int alpha, char *color);
+
+/**
+* @brief Spawn particles right away, regardless of the rate.
+* @param emitter A ptr to the emitter.
+* @param count A number of particles to spawn.
+*/
+extern void tk_emitter_burst(tk_emitter_t *emitter, int count);
+
+/**
+* @brief Move and age the particles, remove the dead ones and spawn new ones at the emitter rate.
+* @param emitter A ptr to the emitter.
+* @param dt A deltatime in seconds.
+*/
+extern void tk_emitter_update(tk_emitter_t *emitter, double dt);
+
+/**
+* @brief Draw all the live particles with a single draw call.
+* @param emitter A ptr to the emitter.
+*/
+extern void tk_emitter_draw(tk_emitter_t *emitter);
+
+/* === Entity functions === */
+/**
+* @brief Create an entity storage. All memory is allocated here.
+* @param capacity A maximum number of live entities (up to 1048576).
+* @return A ptr to the world.
+*/
+extern tk_world_t* tk_world_create(size_t capacity);
+
+/**
+* @brief Destroy an entity storage.
+* @param world A ptr to the world.
+*/
+extern void tk_world_destroy(tk_world_t *world);
+
+/**
+* @brief Create an entity. Its velocity starts at 0.
+* @param world A ptr to the world.
+* @param x, y The top left position.
+* @param w, h The size.
+* @param color A color to draw the entity with.
+* @param flags TK_ENTITY_CLAMP and / or TK_ENTITY_SOLID, 0 for none.
+* @return A handle to the entity, TK_ENTITY_NONE if the world is full.
+*/
+extern tk_entity_t tk_entity_create(tk_world_t *world, float x, float y, float w, float h, char *color, Uint8 flags);
+
+/**
+* @brief Destroy an entity. The last entity is moved into its slot. Does nothing for stale handles.
+* @param world A ptr to the world.
+* @param entity A handle to the entity.
+*/
+extern void tk_entity_destroy(tk_world_t *world, tk_entity_t entity);
+
+/**
+* @brief Return if the handle refers to a live entity.
+* @param world A ptr to the world.
+* @param entity A handle to the entity.
+*/
+extern bool tk_entity_alive(tk_world_t *world, tk_entity_t entity);
+
+/**
+* @brief Return the slot of an entity in the component arrays. Slots change when entities are destroyed.
+* @param world A ptr to the world.
+* @param entity A handle to the entity.
+* @return The slot, TK_ENTITY_NO_SLOT for stale handles.
+*/
+extern size_t tk_entity_slot(tk_world_t *world, tk_entity_t entity);
+
+/**
+* @brief Move every entity by its velocity.
+* @param world A ptr to the world.
+* @param dt A deltatime in seconds.
+*/
+extern void tk_world_move(tk_world_t *world, double dt);
+
+/**
+* @brief Keep every TK_ENTITY_CLAMP entity fully inside the bounds.
+* @param world A ptr to the world.
+* @param min_x, min_y The top left corner of the bounds.
+* @param max_x, max_y The bottom right corner of the bounds.
+*/
+extern void tk_world_clamp(tk_world_t *world, float min_x, float min_y, float max_x, float max_y);
+
+/**
+* @brief Find the TK_ENTITY_SOLID entities overlapping an entity.
+* @param world A ptr to the world.
+* @param entity A handle to the entity to test.
+* @param hits An array to store the handles of the overlapping entities to.
+* @param max_hits The length of the hits array.
+* @return The number of handles stored in hits.
+*/
+extern size_t tk_world_collide(tk_world_t *world, tk_entity_t entity, tk_entity_t *hits, size_t max_hits);
+
+/**
+* @brief Draw every entity as a filled rect with a single draw call.
+* @param world A ptr to the world.
+*/
+extern void tk_world_draw(tk_world_t *world);
+
+/* === Audio functions === */
+/*
+Sounds are mixed in the SDL audio callback. If audio can not be opened the game runs silent and
+these functions return -1. Set SDL_AUDIODRIVER=dummy (or disk) to run without a sound card.
+*/
+
+/**
+* @brief Load a WAV file as a sound. Must be called after tk_app_init().
+* @param path A path to the WAV file.
+* @return An id of the sound, -1 on failure.
+*/
+extern int tk_sound_load_wav(char *path);
+
+/**
+* @brief Load 16 bit mono samples as a sound. The samples are copied. Must be called after tk_app_init().
+* @param samples An array of samples.
+* @param count The number of samples.
+* @param frequency The sample rate of the samples in Hz, they are converted to the output rate.
+* @return An id of the sound, -1 on failure.
+*/
+extern int tk_sound_load_pcm(const Sint16 *samples, size_t count, int frequency);
+
+/**
+* @brief Start playing a sound. Never blocks, the request is picked up by the next audio callback.
+* @param sound An id of the sound.
+* @param volume A volume from 0.0 to 1.0.
+* @return 0 on success, -1 if the sound does not exist or too many requests are pending.
+*/
+extern int tk_sound_play(int sound, float volume);
+
+/* === Snapshot functions === */
+/**
+* @brief Start writing or reading a snapshot.
+* @param snapshot A ptr to the cursor to initialize.
+* @param data A buffer holding the snapshot.
+* @param size The size of the buffer in bytes.
+*/
+extern void tk_snapshot_begin(tk_snapshot_t *snapshot, void *data, size_t size);
+
+/**
+* @brief Append a value to the snapshot, without padding.
+* @param snapshot A ptr to the cursor.
+* @param value A ptr to the value to write.
+* @param size The size of the value in bytes.
+* @return 0 on success, -1 if the buffer is full.
+*/
+extern int tk_snapshot_write(tk_snapshot_t *snapshot, const void *value, size_t size);
+
+/**
+* @brief Read the next value of the snapshot.
+* @param snapshot A ptr to the cursor.
+* @param value A ptr to store the value to.
+* @param size The size of the value in bytes.
+* @return 0 on success, -1 if the snapshot has no more data.
+*/
+extern int tk_snapshot_read(tk_snapshot_t *snapshot, void *value, size_t size);
+
+/**
+* @brief Create a rewind buffer. Frames are stored as keyframes plus XOR deltas against the previous frame,
+* and the oldest frames are dropped to stay within the memory budget.
+* @param frame_size The size of every frame in bytes.
+* @param budget The total memory the buffer may use in bytes.
+* @param keyframe_interval Store a full frame every keyframe_interval frames. Seeking costs at most this many deltas.
+* @return A ptr to the rewind buffer, NULL if the budget is too small for the frame size.
+*/
+extern tk_rewind_t* tk_rewind_create(size_t frame_size, size_t budget, int keyframe_interval);
+
+/**
+* @brief Destroy a rewind buffer.
+* @param rewind A ptr to the rewind buffer.
+*/
+extern void tk_rewind_destroy(tk_rewind_t *rewind);
+
+/**
+* @brief Record a new frame.
+* @param rewind A ptr to the rewind buffer.
+* @param frame A ptr to frame_size bytes.
+*/
+extern void tk_rewind_push(tk_rewind_t *rewind, const void *frame);
+
+/**
+* @brief Return the number of frames currently held.
+* @param rewind A ptr to the rewind buffer.
+*/
+extern size_t tk_rewind_count(tk_rewind_t *rewind);
+
+/**
+* @brief Rebuild an older frame without changing the history.
+* @param rewind A ptr to the rewind buffer.
+* @param frames_back How many frames to go back, 0 = the newest frame.
+* @param frame A ptr to frame_size bytes to store the frame to.
+* @return 0 on success, -1 if the history is not that long.
+*/
+extern int tk_rewind_seek(tk_rewind_t *rewind, size_t frames_back, void *frame);
+
+/**
+* @brief Go back in time: drop the newest frames, then rebuild the frame that is now the newest.
+* @param rewind A ptr to the rewind buffer.
+* @param frames How many frames to drop. Stops at the oldest frame.
+* @param frame A ptr to frame_size bytes to store the new newest frame to.
+* @return 0 on success, -1 if the buffer is empty.
+*/
+extern int tk_rewind_step_back(tk_rewind_t *rewind, size_t frames, void *frame);
+
+/* === Frame memory functions === */
+/**
+* @brief Allocate scratch memory from the frame arena. The memory is released by tk_end_drawing(), do not free it.
+* @param size The size of the memory in bytes.
+* @return A ptr to 16 bytes aligned memory, NULL if the arena is full.
+*/
+extern void* tk_frame_alloc(size_t size);
+
+/**
+* @brief Return the number of bytes allocated from the frame arena in the current frame.
+*/
+extern size_t tk_get_frame_arena_used(void);
+
+/**
+* @brief Return the highest number of bytes requested in a single frame so far, including requests that did not fit.
+*/
+extern size_t tk_get_frame_arena_high_water(void);
+
 /* === Math functions === */
 /**
 * @brief Clamp the passed value.
@@ -102,7 +558,59 @@ float tkmt_randf(float min, float max);
 char tkcol_point_vs_rect(int px, int py, int rx, int ry, int rw, int rh);
 char tkcol_rect_vs_rect(int x1, int y1, int w1, int h1, int x2, int y2, int w2, int h2);
 
+/**
+* @brief Predict where a ball moving in a straight line reaches target_x, bouncing off the top and bottom of the window.
+* Computed in closed form, the cost does not depend on the number of bounces.
+* @param x, y The top left position of the ball.
+* @param dx, dy The velocity of the ball.
+* @param h The height of the ball.
+* @param target_x An x position to predict at.
+* @param out_y A ptr to store the top y of the ball at target_x to.
+* @return 1 if the ball reaches target_x, 0 if it is not moving toward it.
+*/
+char tkcol_predict_y(float x, float y, float dx, float dy, int h, float target_x, float *out_y);
+
+/**
+* @brief Batched tkcol_predict_y() for many balls of the same height, stored as one array per field.
+* @param x, y Arrays of the top left positions.
+* @param dx, dy Arrays of the velocities.
+* @param h The height of the balls.
+* @param target_x An x position to predict at.
+* @param out_y An array to store the predicted top y to, -1 for balls not moving toward target_x.
+* @param count The number of balls.
+*/
+void tkcol_predict_y_n(const float *x, const float *y, const float *dx, const float *dy, int h, float target_x,
+                       float *out_y, size_t count);
+
+/*=== Memory functions ===*/
+/**
+* @brief Route the allocations of all ticket.c containers through custom functions.
+* Must be called before tk_app_init() and before creating any container.
+* @param allocator A ptr to the functions to use, NULL to go back to malloc and free.
+*/
+void tk_set_allocator(const tk_allocator_t *allocator);
+
+/**
+* @brief Get the allocation statistics of ticket.c containers.
+* Only counted when ticket.c is built with TK_TRACK_ALLOCATIONS defined, zero otherwise.
+* @param stats A ptr to store the statistics to.
+*/
+void tk_get_alloc_stats(tk_alloc_stats_t *stats);
+
+/**
+* @brief Print the allocation statistics per call site. Sites with live allocations are marked LEAK.
+* tk_app_destroy() prints it too when ticket.c is built with TK_TRACK_ALLOCATIONS defined.
+*/
+void tk_print_alloc_report(void);
+
 /*=== Dynamic Array functions ===*/
+enum tk_darray_header{ /* Dynamic Array's header elements, stored as size_t right before the items */
+    TK_DARRAY_CAPACITY,
+    TK_DARRAY_LENGTH,
+    TK_DARRAY_ITEM_SIZE,
+    TK_DARRAY_HEADER_COUNT,
+};
+
 /**
 * @brief Create a dynamic array.
 * @param item_size The size of the items that will be contained the array in bytes.
@@ -123,6 +631,13 @@ void tk_darray_destroy(void *darray);
 */
 void tk_darray_push(void **darray, const void *item);
 
+/**
+* @brief Grow the darray so that it can hold at least capacity items without resizing.
+* @param darray A double pointer to the darray.
+* @param capacity A number of items to make room for.
+*/
+void tk_darray_reserve(void **darray, size_t capacity);
+
 /**
 * @brief return the number of items currently contain in the array.(This is not the capacity)
 * @param darray A pointer to darray.
@@ -151,6 +666,61 @@ void tk_darray_insert_at(void** darray, void* item, size_t index);
 */
 void tk_darray_erase_at(void* darray, size_t index);
 
+/**
+* @brief Define typed darray functions for T, sharing the memory layout of tk_darray_create().
+* The item size is known at compile time, so pushes and pops are inlined into direct stores and loads.
+* T must be a single identifier (use a typedef for pointers or multi word types). Defines:
+* T* T_darray_create(void), void T_darray_destroy(T*), size_t T_darray_count(const T*),
+* void T_darray_push(T**, T), T T_darray_pop(T*), T* T_darray_at(T*, size_t), void T_darray_clear(T*),
+* void T_darray_reserve(T**, size_t capacity), void T_darray_resize(T**, size_t length).
+* T_darray_resize grows the capacity when needed and sets the length, new items are left uninitialized
+* so they can be written in place.
+*/
+#define TK_DARRAY(T) \
+static inline T* T##_darray_create(void) \
+{ \
+    return (T*)tk_darray_create_at(sizeof(T), #T "_darray_create", 0); \
+} \
+static inline void T##_darray_destroy(T *darray) \
+{ \
+    tk_darray_destroy(darray); \
+} \
+static inline size_t T##_darray_count(const T *darray) \
+{ \
+    return ((const size_t*)(const void*)darray - TK_DARRAY_HEADER_COUNT)[TK_DARRAY_LENGTH]; \
+} \
+static inline void T##_darray_push(T **darray, T item) \
+{ \
+    size_t *header = (size_t*)(void*)*darray - TK_DARRAY_HEADER_COUNT; \
+    if (header[TK_DARRAY_LENGTH] >= header[TK_DARRAY_CAPACITY]){ \
+        tk_darray_reserve((void**)darray, header[TK_DARRAY_LENGTH] + 1); \
+        header = (size_t*)(void*)*darray - TK_DARRAY_HEADER_COUNT; \
+    } \
+    (*darray)[header[TK_DARRAY_LENGTH]++] = item; \
+} \
+static inline T T##_darray_pop(T *darray) \
+{ \
+    size_t *header = (size_t*)(void*)darray - TK_DARRAY_HEADER_COUNT; \
+    return darray[--header[TK_DARRAY_LENGTH]]; \
+} \
+static inline T* T##_darray_at(T *darray, size_t index) \
+{ \
+    return &darray[index]; \
+} \
+static inline void T##_darray_clear(T *darray) \
+{ \
+    ((size_t*)(void*)darray - TK_DARRAY_HEADER_COUNT)[TK_DARRAY_LENGTH] = 0; \
+} \
+static inline void T##_darray_reserve(T **darray, size_t capacity) \
+{ \
+    tk_darray_reserve((void**)darray, capacity); \
+} \
+static inline void T##_darray_resize(T **darray, size_t length) \
+{ \
+    tk_darray_reserve((void**)darray, length); \
+    ((size_t*)(void*)*darray - TK_DARRAY_HEADER_COUNT)[TK_DARRAY_LENGTH] = length; \
+}
+
 /* === Linked List functions ===*/
 /**
 * @brief Create a head node of a singly linked list.
@@ -161,6 +731,7 @@ extern tk_node_t* tk_list_create(void *data);
 
 /**
 * @brief Destroy the list. This function will free all allocated memory for the list, and set the list ptr to NULL.
+* Data is freed with free(), it must come from malloc() when the flag is set.
 * @param list A double ptr to the head node of the list.
 * @param flag A flag to tell if you want to free the adress of data contained.(1 = true, 0 = false)
 */
@@ -221,5 +792,144 @@ extern tk_node_t* tk_list_find(tk_node_t *list, void *data);
 * @return Return 0 on success, -1 on malloc error.
 */
 extern int tk_list_insert_after(tk_node_t *list, void *data_to_insert, void *data_to_find);
+
+/* === Hash map functions ===*/
+/**
+* @brief Create a hash map. Keys and items are copied into flat arrays, keys are compared byte by byte.
+* @param key_size The size of the keys in bytes. Zero the padding of struct keys.
+* @param item_size The size of the items in bytes.
+* @return A ptr to the hash map.
+*/
+extern tk_hashmap_t* tk_hashmap_create(size_t key_size, size_t item_size);
+
+/**
+* @brief Destroy a hash map. This function will free all memory allocated by the hash map.
+* @param map A ptr to the hash map.
+*/
+extern void tk_hashmap_destroy(tk_hashmap_t *map);
+
+/**
+* @brief Insert an item, or overwrite the item if the key is already in the map.
+* @param map A ptr to the hash map.
+* @param key A ptr to the key.
+* @param item A ptr to the item.
+* @return A ptr to the stored item, valid until the next insert, erase or reserve.
+*/
+extern void* tk_hashmap_insert(tk_hashmap_t *map, const void *key, const void *item);
+
+/**
+* @brief Find the item of a key.
+* @param map A ptr to the hash map.
+* @param key A ptr to the key.
+* @return A ptr to the stored item, valid until the next insert, erase or reserve. NULL if the key is not in the map.
+*/
+extern void* tk_hashmap_find(tk_hashmap_t *map, const void *key);
+
+/**
+* @brief Erase the item of a key.
+* @param map A ptr to the hash map.
+* @param key A ptr to the key.
+* @return 0 on success, -1 if the key is not in the map.
+*/
+extern int tk_hashmap_erase(tk_hashmap_t *map, const void *key);
+
+/**
+* @brief Grow the hash map so that it can hold at least count items without resizing.
+* @param map A ptr to the hash map.
+* @param count A number of items to make room for.
+*/
+extern void tk_hashmap_reserve(tk_hashmap_t *map, size_t count);
+
+/**
+* @brief Return the number of items in the hash map.
+* @param map A ptr to the hash map.
+*/
+extern size_t tk_hashmap_count(tk_hashmap_t *map);
+
+/**
+* @brief Remove every item, keeping the memory.
+* @param map A ptr to the hash map.
+*/
+extern void tk_hashmap_clear(tk_hashmap_t *map);
+
+/**
+* @brief Step through the items in no particular order. The map must not be changed while iterating.
+* @param map A ptr to the hash map.
+* @param iterator A ptr to a size_t set to 0 before the first call.
+* @param key A ptr to store a ptr to the key to. Can be NULL.
+* @param item A ptr to store a ptr to the item to. Can be NULL.
+* @return true if key and item were set, false when there are no more items.
+*/
+extern bool tk_hashmap_next(tk_hashmap_t *map, size_t *iterator, void **key, void **item);
+
+/* === Job system functions ===*/
+/**
+* @brief Return the number of worker threads spawned by tk_app_init().
+* @return Number of worker threads (the main thread is not counted).
+*/
+extern int tk_get_worker_count(void);
+
+/**
+* @brief Queue a job. The job may run on any worker thread, or on the thread calling tk_job_wait().
+* @param fn A function to run.
+* @param data A ptr passed to fn.
+* @param counter A counter incremented now and decremented when the job finished. Can be NULL.
+*/
+extern void tk_job_run(tk_job_fn fn, void *data, tk_job_counter_t *counter);
+
+/**
+* @brief Queue a job that will not start before all jobs of the dependency counter have finished.
+* @param fn A function to run.
+* @param data A ptr passed to fn.
+* @param counter A counter incremented now and decremented when the job finished. Can be NULL.
+* @param dependency A counter to wait for before starting the job.
+*/
+extern void tk_job_run_after(tk_job_fn fn, void *data, tk_job_counter_t *counter, tk_job_counter_t *dependency);
+
+/**
+* @brief Split the index range [0, count) into jobs of grain indices and queue them.
+* @param count Number of indices to process.
+* @param grain Number of indices per job. 0 = pick one from the worker count.
+* @param fn A function called with each sub range.
+* @param data A ptr passed to fn.
+* @param counter A counter to track the jobs. If NULL, the function waits until all the jobs have finished.
+*/
+extern void tk_job_parallel_for(size_t count, size_t grain, tk_job_range_fn fn, void *data, tk_job_counter_t *counter);
+
+/**
+* @brief Wait until the counter reaches zero. The calling thread runs queued jobs while waiting.
+* @param counter A ptr to the counter to wait for.
+*/
+extern void tk_job_wait(tk_job_counter_t *counter);
+
+/**
+* @brief Return if all the jobs tracked by the counter have finished.
+* @param counter A ptr to the counter.
+*/
+extern bool tk_job_is_done(tk_job_counter_t *counter);
+
+/*=== Allocation sites ===*/
+/*
+The create functions with the site of the caller, used by the report of tk_print_alloc_report().
+Memory a container allocates later (growth, nodes) is charged to the site that created it.
+With TK_TRACK_ALLOCATIONS defined, the create functions pass __FILE__ and __LINE__ to these.
+Typed darrays (TK_DARRAY) are reported as T_darray_create.
+*/
+extern void* tk_darray_create_at(size_t item_size, const char *file, int line);
+extern tk_node_t* tk_list_create_at(void *data, const char *file, int line);
+extern tk_hashmap_t* tk_hashmap_create_at(size_t key_size, size_t item_size, const char *file, int line);
+extern tk_emitter_t* tk_emitter_create_at(size_t capacity, const char *file, int line);
+extern tk_world_t* tk_world_create_at(size_t capacity, const char *file, int line);
+extern tk_rewind_t* tk_rewind_create_at(size_t frame_size, size_t budget, int keyframe_interval, const char *file, int line);
+
+#if defined(TK_TRACK_ALLOCATIONS) && !defined(TICKET_C)
+#define tk_darray_create(item_size) tk_darray_create_at((item_size), __FILE__, __LINE__)
+#define tk_list_create(data) tk_list_create_at((data), __FILE__, __LINE__)
+#define tk_hashmap_create(key_size, item_size) tk_hashmap_create_at((key_size), (item_size), __FILE__, __LINE__)
+#define tk_emitter_create(capacity) tk_emitter_create_at((capacity), __FILE__, __LINE__)
+#define tk_world_create(capacity) tk_world_create_at((capacity), __FILE__, __LINE__)
+#define tk_rewind_create(frame_size, budget, keyframe_interval) \
+tk_rewind_create_at((frame_size), (budget), (keyframe_interval), __FILE__, __LINE__)
+#endif
 #endif /* TICKET_H */
 